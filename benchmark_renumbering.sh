@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+# compares cache misses of runs with and without --renumber.
+# usage: ./benchmark_renumbering.sh [reaction_database initial_state_database]
+# uses perf stat for the hardware counters when it is installed, otherwise
+# only reports run times. The renumbered run also logs the cache lines of
+# propensities updated per species changed, before and after renumbering.
+
+reaction_database=${1:-./test_materials/rn.sqlite}
+initial_state_database=${2:-./test_materials/initial_state.sqlite}
+copy=./benchmark_initial_state_copy.sqlite
+
+rnmc="./RNMC --reaction_database=$reaction_database --initial_state_database=$copy --number_of_simulations=40 --base_seed=1000 --thread_count=1 --step_cutoff=50000 --dependency_threshold=0"
+events=cycles,instructions,cache-references,cache-misses,L1-dcache-load-misses
+
+if ! command -v perf > /dev/null; then
+    echo "perf not found, reporting run times only"
+fi
+
+for renumber in "" "--renumber"; do
+    echo "RNMC ${renumber:-(ids from the database)}"
+    cp $initial_state_database $copy
+    if command -v perf > /dev/null; then
+        perf stat -e $events $rnmc $renumber | grep renumbering
+    else
+        time $rnmc $renumber | grep renumbering
+    fi
+    rm $copy
+done
@@ -1 +1 @@
-$CC ./src/*.c -o RNMC $(gsl-config --cflags) $(gsl-config --libs) -lsqlite3 -lpthread
+$CC $CFLAGS ./src/*.c -o RNMC $(gsl-config --cflags) $(gsl-config --libs) -lsqlite3 -lpthread
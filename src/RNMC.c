@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <string.h>
 #include "dispatcher.h"
 
 void print_usage() {
@@ -13,16 +14,128 @@ void print_usage() {
         "--thread_count\n"
         "--step_cutoff\n"
         "--dependency_threshold\n"
+        "optionally\n"
+        "--tau_leaping\n"
+        "--solver (linear, tree, composition_rejection, wide_tree,\n"
+        "          next_reaction, integer_tree, active_set,\n"
+        "          sorting_linear, partial_propensity or auto)\n"
+        "--rng (gsl or philox)\n"
+        "--dependency_cache\n"
+        "--dependency_memory_budget (bytes)\n"
+        "--renumber\n"
+        "--shared_network (name)\n"
+        "--reduce\n"
+        "--float_times\n"
+        "\n"
+        "or, to compile a network for faster startup,\n"
+        "RNMC compile --reaction_database --initial_state_database --output\n"
+        "optionally --reduce and --renumber\n"
+        "and pass the output as --reaction_database\n"
         );
 }
 
-int main(int argc, char **argv) {
+// RNMC compile: read the network from sqlite once and write it in the
+// format of compiled_network.h
+int compile(int argc, char **argv) {
+
+    struct option long_options[] = {
+        {"reaction_database", required_argument, NULL, 1},
+        {"initial_state_database", required_argument, NULL, 2},
+        {"output", required_argument, NULL, 3},
+        {"renumber", no_argument, NULL, 4},
+        {"reduce", no_argument, NULL, 5},
+        {NULL, 0, NULL, 0}
+    };
+
+    int c;
+    int option_index = 0;
+    char *reaction_database = NULL;
+    char *initial_state_database = NULL;
+    char *output = NULL;
+    bool renumber = false;
+    bool reduce = false;
+
+    while ((c = getopt_long_only(
+                argc, argv, "",
+                long_options,
+                &option_index)) != -1) {
+
+        switch (c) {
+
+        case 1:
+            reaction_database = optarg;
+            break;
+
+        case 2:
+            initial_state_database = optarg;
+            break;
 
-    if (argc != 8) {
+        case 3:
+            output = optarg;
+            break;
+
+        case 4:
+            renumber = true;
+            break;
+
+        case 5:
+            reduce = true;
+            break;
+
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+
+        }
+    }
+
+    if (! reaction_database || ! initial_state_database || ! output) {
         print_usage();
-        exit(EXIT_FAILURE);
+        return EXIT_FAILURE;
     }
 
+    sqlite3 *reaction_db;
+    sqlite3 *initial_state_db;
+    sqlite3_open(reaction_database, &reaction_db);
+    sqlite3_open(initial_state_database, &initial_state_db);
+
+    ReactionNetwork *reaction_network = new_reaction_network(
+        reaction_db, initial_state_db, 0);
+
+    int number_of_unfireable, number_of_merged;
+    if (reaction_network && reduce &&
+        reduce_reaction_network(reaction_network,
+                                &number_of_unfireable,
+                                &number_of_merged))
+        printf("dropped %d reactions which can't fire and merged %d duplicates\n",
+               number_of_unfireable, number_of_merged);
+
+    if (reaction_network && renumber)
+        renumber_reaction_network(reaction_network);
+
+    bool ok = reaction_network &&
+        compile_reaction_network(reaction_network, output);
+
+    if (ok)
+        printf("compiled %d reactions and %d species to %s\n",
+               reaction_network->number_of_reactions,
+               reaction_network->number_of_species,
+               output);
+    else
+        printf("couldn't compile the network to %s\n", output);
+
+    if (reaction_network)
+        free_reaction_network(reaction_network);
+    sqlite3_close(reaction_db);
+    sqlite3_close(initial_state_db);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc > 1 && strcmp(argv[1], "compile") == 0)
+        exit(compile(argc - 1, argv + 1));
 
     struct option long_options[] = {
         {"reaction_database", required_argument, NULL, 1},
@@ -32,6 +145,15 @@ int main(int argc, char **argv) {
         {"thread_count", required_argument, NULL, 5},
         {"step_cutoff", required_argument, NULL, 6},
         {"dependency_threshold", required_argument, NULL, 7},
+        {"tau_leaping", no_argument, NULL, 8},
+        {"solver", required_argument, NULL, 9},
+        {"rng", required_argument, NULL, 10},
+        {"dependency_cache", required_argument, NULL, 11},
+        {"dependency_memory_budget", required_argument, NULL, 12},
+        {"renumber", no_argument, NULL, 13},
+        {"shared_network", required_argument, NULL, 14},
+        {"reduce", no_argument, NULL, 15},
+        {"float_times", no_argument, NULL, 16},
         {NULL, 0, NULL, 0}
         // last element of options array needs to be filled with zeros
     };
@@ -39,14 +161,24 @@ int main(int argc, char **argv) {
     int c;
     int option_index = 0;
 
-    char *reaction_database;
-    char *initial_state_database;
-    int number_of_simulations;
-    int base_seed;
-    int thread_count;
-    int step_cutoff;
-    int dependency_threshold;
-    bool logging = true;
+    // required options are checked against these after parsing
+    char *reaction_database = NULL;
+    char *initial_state_database = NULL;
+    int number_of_simulations = -1;
+    int base_seed = -1;
+    int thread_count = -1;
+    int step_cutoff = -1;
+    int dependency_threshold = -1;
+    bool tau_leaping = false;
+    int solve_type = tree;
+    bool calibrate_solver = false;
+    int sampler_type = gsl_sampler;
+    char *dependency_cache = NULL;
+    size_t dependency_memory_budget = 0;
+    bool renumber = false;
+    char *shared_network = NULL;
+    bool reduce = false;
+    bool float_times = false;
 
     while ((c = getopt_long_only(
                 argc, argv, "",
@@ -61,6 +193,7 @@ int main(int argc, char **argv) {
 
         case 2:
             initial_state_database = optarg;
+            break;
 
         case 3:
             number_of_simulations = atoi(optarg);
@@ -82,6 +215,54 @@ int main(int argc, char **argv) {
             dependency_threshold = atoi(optarg);
             break;
 
+        case 8:
+            tau_leaping = true;
+            break;
+
+        case 9:
+            if (strcmp(optarg, "auto") == 0)
+                calibrate_solver = true;
+            else {
+                solve_type = solve_type_from_name(optarg);
+                if (solve_type < 0) {
+                    print_usage();
+                    exit(EXIT_FAILURE);
+                }
+            }
+            break;
+
+        case 10:
+            sampler_type = sampler_type_from_name(optarg);
+            if (sampler_type < 0) {
+                print_usage();
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 11:
+            dependency_cache = optarg;
+            break;
+
+        case 12:
+            dependency_memory_budget = strtoull(optarg, NULL, 10);
+            break;
+
+        case 13:
+            renumber = true;
+            break;
+
+        case 14:
+            shared_network = optarg;
+            break;
+
+        case 15:
+            reduce = true;
+            break;
+
+        case 16:
+            float_times = true;
+            break;
+
         default:
             // if an unexpected argument is passed, exit
             print_usage();
@@ -92,6 +273,17 @@ int main(int argc, char **argv) {
 
     }
 
+    if (! reaction_database ||
+        ! initial_state_database ||
+        number_of_simulations < 0 ||
+        base_seed < 0 ||
+        thread_count < 0 ||
+        step_cutoff < 0 ||
+        dependency_threshold < 0) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
     Dispatcher *dispatcher = new_dispatcher(
         reaction_database,
         initial_state_database,
@@ -100,6 +292,16 @@ int main(int argc, char **argv) {
         thread_count,
         step_cutoff,
         dependency_threshold,
+        dependency_cache,
+        dependency_memory_budget,
+        reduce,
+        renumber,
+        shared_network,
+        float_times,
+        tau_leaping,
+        solve_type,
+        sampler_type,
+        calibrate_solver,
         true
         );
 
@@ -0,0 +1,382 @@
+#include "compiled_network.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CHECKSUM_OFFSET_BASIS 0xcbf29ce484222325ull
+#define CHECKSUM_PRIME 0x100000001b3ull
+
+// FNV style hash a word at a time, so checking a large file
+// doesn't take longer than reading it
+static uint64_t checksum(char *data, size_t size) {
+    uint64_t hash = CHECKSUM_OFFSET_BASIS;
+    uint64_t word;
+
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        memcpy(&word, data + i, sizeof(uint64_t));
+        hash = (hash ^ word) * CHECKSUM_PRIME;
+    }
+
+    return hash;
+}
+
+static uint64_t align(uint64_t offset) {
+    return (offset + COMPILED_NETWORK_ALIGNMENT - 1)
+        / COMPILED_NETWORK_ALIGNMENT * COMPILED_NETWORK_ALIGNMENT;
+}
+
+bool is_compiled_network(char *path) {
+    char magic[8];
+    FILE *file = fopen(path, "rb");
+    if (! file)
+        return false;
+
+    bool compiled = fread(magic, 1, 8, file) == 8 &&
+        memcmp(magic, COMPILED_NETWORK_MAGIC, 8) == 0;
+
+    fclose(file);
+    return compiled;
+}
+
+uint64_t layout_compiled_network(ReactionNetwork *reaction_network,
+                                 CompiledNetworkHeader *header) {
+    int number_of_reactions = reaction_network->number_of_reactions;
+    int number_of_species = reaction_network->number_of_species;
+
+    memset(header, 0, sizeof(CompiledNetworkHeader));
+    memcpy(header->magic, COMPILED_NETWORK_MAGIC, 8);
+    header->version = COMPILED_NETWORK_VERSION;
+    header->header_size = sizeof(CompiledNetworkHeader);
+    header->number_of_species = number_of_species;
+    header->number_of_reactions = number_of_reactions;
+    header->reduced = reaction_network->reduced;
+    header->factor_zero = reaction_network->factor_zero;
+    header->factor_two = reaction_network->factor_two;
+    header->factor_duplicate = reaction_network->factor_duplicate;
+
+    header->section_sizes[section_number_of_reactants] =
+        number_of_reactions * sizeof(uint8_t);
+    header->section_sizes[section_reactants] =
+        2 * number_of_reactions * sizeof(int);
+    header->section_sizes[section_number_of_products] =
+        number_of_reactions * sizeof(uint8_t);
+    header->section_sizes[section_products] =
+        2 * number_of_reactions * sizeof(int);
+    header->section_sizes[section_rates] =
+        number_of_reactions * sizeof(double);
+    header->section_sizes[section_packed_reactions] =
+        number_of_reactions * sizeof(PackedReaction);
+    header->section_sizes[section_all_reactions] =
+        number_of_reactions * sizeof(int);
+    header->section_sizes[section_species_reactions_offsets] =
+        (number_of_species + 1) * sizeof(int);
+    header->section_sizes[section_species_reactions] =
+        reaction_network->species_reactions_offsets[number_of_species]
+        * sizeof(int);
+    header->section_sizes[section_initial_state] =
+        number_of_species * sizeof(int);
+    header->section_sizes[section_initial_propensities] =
+        number_of_reactions * sizeof(double);
+
+    if (reaction_network->reaction_ids)
+        header->section_sizes[section_reaction_ids] =
+            number_of_reactions * sizeof(int);
+
+    if (reaction_network->species_ids)
+        header->section_sizes[section_species_ids] =
+            number_of_species * sizeof(int);
+
+    if (reaction_network->merged_offsets) {
+        int number_of_merged =
+            reaction_network->merged_offsets[number_of_reactions];
+        header->section_sizes[section_merged_offsets] =
+            (number_of_reactions + 1) * sizeof(int);
+        header->section_sizes[section_merged_reactions] =
+            number_of_merged * sizeof(int);
+        header->section_sizes[section_merged_shares] =
+            number_of_merged * sizeof(double);
+    }
+
+    uint64_t offset = align(sizeof(CompiledNetworkHeader));
+    for (int i = 0; i < NUMBER_OF_COMPILED_NETWORK_SECTIONS; i++) {
+        header->section_offsets[i] = offset;
+        offset = align(offset + header->section_sizes[i]);
+    }
+    header->file_size = offset;
+
+    return offset;
+}
+
+void write_compiled_network(ReactionNetwork *reaction_network,
+                            CompiledNetworkHeader *header,
+                            char *image) {
+
+    void *sections[NUMBER_OF_COMPILED_NETWORK_SECTIONS] = {
+        reaction_network->number_of_reactants,
+        reaction_network->reactants[0],
+        reaction_network->number_of_products,
+        reaction_network->products[0],
+        reaction_network->rates,
+        reaction_network->packed_reactions,
+        reaction_network->all_reactions,
+        reaction_network->species_reactions_offsets,
+        reaction_network->species_reactions,
+        reaction_network->initial_state,
+        reaction_network->initial_propensities,
+        reaction_network->reaction_ids,
+        reaction_network->species_ids,
+        reaction_network->merged_offsets,
+        reaction_network->merged_reactions,
+        reaction_network->merged_shares,
+    };
+
+    // padding is zeroed, so the checksum covers exactly the bytes written
+    memset(image, 0, header->file_size);
+    for (int i = 0; i < NUMBER_OF_COMPILED_NETWORK_SECTIONS; i++)
+        if (header->section_sizes[i])
+            memcpy(image + header->section_offsets[i],
+                   sections[i],
+                   header->section_sizes[i]);
+
+    size_t body_offset = align(sizeof(CompiledNetworkHeader));
+    header->checksum = checksum(image + body_offset,
+                                header->file_size - body_offset);
+    memcpy(image, header, sizeof(CompiledNetworkHeader));
+}
+
+bool compile_reaction_network(ReactionNetwork *reaction_network, char *path) {
+    CompiledNetworkHeader header;
+    uint64_t size = layout_compiled_network(reaction_network, &header);
+    char *contents = malloc(size);
+    write_compiled_network(reaction_network, &header, contents);
+
+    char temporary_path[4096];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.%d.tmp",
+             path, (int) getpid());
+
+    bool ok = false;
+    FILE *file = fopen(temporary_path, "wb");
+    if (file) {
+        ok = fwrite(contents, 1, size, file) == size;
+        ok = (fclose(file) == 0) && ok;
+        ok = ok && rename(temporary_path, path) == 0;
+        if (! ok)
+            remove(temporary_path);
+    }
+
+    free(contents);
+    return ok;
+}
+
+ReactionNetwork *reaction_network_from_image(char *mapping,
+                                              size_t size,
+                                              int dependency_threshold,
+                                              bool verify_checksum) {
+
+    if (size < sizeof(CompiledNetworkHeader))
+        return NULL;
+
+    CompiledNetworkHeader *header = (CompiledNetworkHeader *) mapping;
+    int number_of_reactions = header->number_of_reactions;
+    int number_of_species = header->number_of_species;
+    size_t body_offset = align(sizeof(CompiledNetworkHeader));
+    bool ok = memcmp(header->magic, COMPILED_NETWORK_MAGIC, 8) == 0 &&
+        header->version == COMPILED_NETWORK_VERSION &&
+        header->header_size == sizeof(CompiledNetworkHeader) &&
+        header->file_size <= size &&
+        number_of_reactions >= 0 &&
+        number_of_species > 0;
+
+    for (int i = 0; ok && i < NUMBER_OF_COMPILED_NETWORK_SECTIONS; i++)
+        ok = header->section_offsets[i] >= body_offset &&
+            header->section_offsets[i] % COMPILED_NETWORK_ALIGNMENT == 0 &&
+            header->section_offsets[i] + header->section_sizes[i]
+            <= header->file_size;
+
+    ok = ok &&
+        header->section_sizes[section_reactants] ==
+        2 * number_of_reactions * sizeof(int) &&
+        header->section_sizes[section_products] ==
+        2 * number_of_reactions * sizeof(int) &&
+        header->section_sizes[section_packed_reactions] ==
+        number_of_reactions * sizeof(PackedReaction) &&
+        header->section_sizes[section_species_reactions_offsets] ==
+        (number_of_species + 1) * sizeof(int) &&
+        header->section_sizes[section_initial_state] ==
+        number_of_species * sizeof(int) &&
+        header->section_sizes[section_initial_propensities] ==
+        number_of_reactions * sizeof(double) &&
+        (header->section_sizes[section_reaction_ids] == 0 ||
+         header->section_sizes[section_reaction_ids] ==
+         number_of_reactions * sizeof(int)) &&
+        (header->section_sizes[section_species_ids] == 0 ||
+         header->section_sizes[section_species_ids] ==
+         number_of_species * sizeof(int)) &&
+        (header->section_sizes[section_merged_offsets] == 0 ||
+         header->section_sizes[section_merged_offsets] ==
+         (number_of_reactions + 1) * sizeof(int)) &&
+        header->section_sizes[section_merged_reactions] / sizeof(int) ==
+        header->section_sizes[section_merged_shares] / sizeof(double) &&
+        (header->section_sizes[section_merged_offsets] == 0) ==
+        (header->section_sizes[section_merged_reactions] == 0);
+
+    // reads the whole image once, which also warms the page cache
+    ok = ok && (! verify_checksum ||
+                checksum(mapping + body_offset, header->file_size - body_offset)
+                == header->checksum);
+
+    if (! ok)
+        return NULL;
+
+    ReactionNetwork *reaction_network = calloc(1, sizeof(ReactionNetwork));
+    reaction_network->number_of_species = number_of_species;
+    reaction_network->number_of_reactions = number_of_reactions;
+    reaction_network->reduced = header->reduced != 0;
+    reaction_network->factor_zero = header->factor_zero;
+    reaction_network->factor_two = header->factor_two;
+    reaction_network->factor_duplicate = header->factor_duplicate;
+    reaction_network->dependency_threshold = dependency_threshold;
+
+#define SECTION(section) ((void *) (mapping + header->section_offsets[section]))
+
+    reaction_network->number_of_reactants = SECTION(section_number_of_reactants);
+    reaction_network->number_of_products = SECTION(section_number_of_products);
+    reaction_network->rates = SECTION(section_rates);
+    reaction_network->packed_reactions = SECTION(section_packed_reactions);
+    reaction_network->all_reactions = SECTION(section_all_reactions);
+    reaction_network->species_reactions_offsets =
+        SECTION(section_species_reactions_offsets);
+    reaction_network->species_reactions = SECTION(section_species_reactions);
+    reaction_network->initial_state = SECTION(section_initial_state);
+    reaction_network->initial_propensities =
+        SECTION(section_initial_propensities);
+
+    if (header->section_sizes[section_reaction_ids])
+        reaction_network->reaction_ids = SECTION(section_reaction_ids);
+
+    if (header->section_sizes[section_species_ids])
+        reaction_network->species_ids = SECTION(section_species_ids);
+
+    if (header->section_sizes[section_merged_offsets]) {
+        reaction_network->merged_offsets = SECTION(section_merged_offsets);
+        reaction_network->merged_reactions = SECTION(section_merged_reactions);
+        reaction_network->merged_shares = SECTION(section_merged_shares);
+    }
+
+    int *reactants_values = SECTION(section_reactants);
+    int *products_values = SECTION(section_products);
+
+#undef SECTION
+
+    reaction_network->reactants = calloc(number_of_reactions, sizeof(int *));
+    reaction_network->products = calloc(number_of_reactions, sizeof(int *));
+
+    for (int i = 0; i < number_of_reactions; i++) {
+        reaction_network->reactants[i] = reactants_values + 2 * i;
+        reaction_network->products[i] = products_values + 2 * i;
+    }
+
+    initialize_dependency_graph(reaction_network);
+
+    return reaction_network;
+}
+
+ReactionNetwork *new_reaction_network_from_compiled(
+    char *path,
+    int dependency_threshold) {
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("new_reaction_network_from_compiled error: can't open %s\n", path);
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 ||
+        (size_t) file_stat.st_size < sizeof(CompiledNetworkHeader)) {
+        printf("new_reaction_network_from_compiled error: %s is too short\n",
+               path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = file_stat.st_size;
+    char *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        printf("new_reaction_network_from_compiled error: can't map %s\n", path);
+        return NULL;
+    }
+
+    ReactionNetwork *reaction_network = reaction_network_from_image(
+        mapping, size, dependency_threshold, true);
+
+    if (! reaction_network) {
+        printf("new_reaction_network_from_compiled error: "
+               "%s is not a valid compiled network\n", path);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    reaction_network->network_mapping = mapping;
+    reaction_network->network_mapping_size = size;
+    return reaction_network;
+}
+
+// true if the reactions which can fire from initial_state were all kept
+// when reducing for image_state: every species present (or, for A + A,
+// plentiful) in initial_state was in image_state
+static bool reduction_covers(ReactionNetwork *reaction_network,
+                             int *image_state,
+                             int *initial_state) {
+    for (int i = 0; i < reaction_network->number_of_species; i++)
+        if ((initial_state[i] > 0 && image_state[i] == 0) ||
+            (initial_state[i] > 1 && image_state[i] < 2))
+            return false;
+
+    return true;
+}
+
+bool read_image_initial_state(ReactionNetwork *reaction_network,
+                              sqlite3 *initial_state_database,
+                              char *name) {
+    // these point into the image
+    int *image_state = reaction_network->initial_state;
+    double factor_zero = reaction_network->factor_zero;
+    double factor_two = reaction_network->factor_two;
+    double factor_duplicate = reaction_network->factor_duplicate;
+
+    if (! read_initial_state(reaction_network, initial_state_database))
+        return false;
+
+    bool same_factors = reaction_network->factor_zero == factor_zero &&
+        reaction_network->factor_two == factor_two &&
+        reaction_network->factor_duplicate == factor_duplicate;
+
+    // the common case, where the precomputed propensities still hold
+    if (same_factors &&
+        memcmp(image_state, reaction_network->initial_state,
+               reaction_network->number_of_species * sizeof(int)) == 0) {
+        free(reaction_network->initial_state);
+        reaction_network->initial_state = image_state;
+        return true;
+    }
+
+    if (reaction_network->reduced &&
+        ! reduction_covers(reaction_network, image_state,
+                           reaction_network->initial_state)) {
+        printf("read_image_initial_state error: %s was reduced for an "
+               "initial state without some of the species in ours\n", name);
+        return false;
+    }
+
+    // the packed rates are premultiplied by the factors
+    if (! same_factors)
+        initialize_packed_reactions(reaction_network);
+
+    initialize_propensities(reaction_network);
+    return true;
+}
@@ -0,0 +1,115 @@
+#ifndef COMPILED_NETWORK_H
+#define COMPILED_NETWORK_H
+
+#include "reaction_network.h"
+
+/***************************************************************************/
+/* compiled networks                                                       */
+/* reading a large network from sqlite row by row dominates the startup of */
+/* short jobs. RNMC compile writes the reaction network and initial state  */
+/* to a binary file holding the arrays of ReactionNetwork exactly as they  */
+/* are laid out in memory, each in its own section aligned to              */
+/* COMPILED_NETWORK_ALIGNMENT. Loading it maps the file read only and      */
+/* points the arrays into the mapping, so startup only builds the row      */
+/* pointers and the (empty) dependency graph, and concurrent jobs on a     */
+/* node share the page cache.                                              */
+/*                                                                         */
+/* a network reduced or renumbered before compiling (RNMC compile --reduce */
+/* --renumber) stays so, see reduction.h and renumbering.h.                */
+/*                                                                         */
+/* runs read their own initial state and factors over the compiled ones,   */
+/* see read_image_initial_state. The compiled initial propensities are     */
+/* only used when they are the same.                                       */
+/*                                                                         */
+/* the file is native byte order. It is rejected if the magic, version,    */
+/* header size or size don't match, or if the checksum of everything after */
+/* the header is wrong.                                                    */
+/***************************************************************************/
+
+#define COMPILED_NETWORK_MAGIC "RNMCNET1"
+#define COMPILED_NETWORK_VERSION 4
+#define COMPILED_NETWORK_ALIGNMENT 64
+
+typedef enum compiledNetworkSection {
+    section_number_of_reactants,
+    section_reactants,
+    section_number_of_products,
+    section_products,
+    section_rates,
+    section_packed_reactions,
+    section_all_reactions,
+    section_species_reactions_offsets,
+    section_species_reactions,
+    section_initial_state,
+    section_initial_propensities,
+    section_reaction_ids, // empty unless reduced or renumbered
+    section_species_ids, // empty unless renumbered
+    section_merged_offsets, // empty unless reactions were merged
+    section_merged_reactions,
+    section_merged_shares,
+} CompiledNetworkSection;
+
+#define NUMBER_OF_COMPILED_NETWORK_SECTIONS 16
+
+typedef struct compiledNetworkHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size; // sizeof(CompiledNetworkHeader)
+    uint64_t file_size;
+    uint64_t checksum; // of the file after the header
+    int32_t number_of_species;
+    int32_t number_of_reactions;
+    int32_t reduced; // 1 if reduced, for the initial state in the file
+    int32_t unused;
+    double factor_zero;
+    double factor_two;
+    double factor_duplicate;
+    // in bytes from the start of the file
+    uint64_t section_offsets[NUMBER_OF_COMPILED_NETWORK_SECTIONS];
+    uint64_t section_sizes[NUMBER_OF_COMPILED_NETWORK_SECTIONS];
+} CompiledNetworkHeader;
+
+// true if the file at path starts with COMPILED_NETWORK_MAGIC
+bool is_compiled_network(char *path);
+
+// write reaction_network (and its initial state) to path.
+// returns false if the file couldn't be written
+bool compile_reaction_network(ReactionNetwork *reaction_network, char *path);
+
+// fills in header for reaction_network and returns the size of its image
+uint64_t layout_compiled_network(ReactionNetwork *reaction_network,
+                                 CompiledNetworkHeader *header);
+
+// writes the image laid out by layout_compiled_network to image,
+// header->file_size bytes, and sets the checksum
+void write_compiled_network(ReactionNetwork *reaction_network,
+                            CompiledNetworkHeader *header,
+                            char *image);
+
+// a network whose arrays point into the image at mapping, which is at
+// least size bytes long. Returns NULL if the image doesn't check out.
+// Doesn't take ownership of the mapping, the caller sets network_mapping
+ReactionNetwork *reaction_network_from_image(char *mapping,
+                                              size_t size,
+                                              int dependency_threshold,
+                                              bool verify_checksum);
+
+// the counterpart of new_reaction_network for compiled networks.
+// returns NULL if the file can't be mapped or doesn't check out. The
+// network has the initial state and factors it was compiled with, see
+// read_image_initial_state
+ReactionNetwork *new_reaction_network_from_compiled(
+    char *path,
+    int dependency_threshold);
+
+// replaces the initial state and factors of a network loaded from an
+// image with those in initial_state_database, as new_reaction_network
+// reads them. Returns false if they can't be read, or if the image was
+// reduced for an initial state which doesn't have every species present
+// (or plentiful) in this one, since reactions this one needs were
+// dropped. name is the image, for the messages
+bool read_image_initial_state(ReactionNetwork *reaction_network,
+                              sqlite3 *initial_state_database,
+                              char *name);
+
+#endif
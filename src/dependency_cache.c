@@ -0,0 +1,299 @@
+#include "dependency_cache.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+static uint64_t fnv_int(uint64_t hash, int value) {
+    uint32_t bits = (uint32_t) value;
+    for (int i = 0; i < 4; i++) {
+        hash ^= (bits >> (8 * i)) & 0xff;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t fnv_double(uint64_t hash, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+    hash = fnv_int(hash, (int) (uint32_t) bits);
+    return fnv_int(hash, (int) (uint32_t) (bits >> 32));
+}
+
+// the hash of a reaction, in the order of network_fingerprint
+static uint64_t fnv_reaction(uint64_t hash,
+                             int number_of_reactants, int *reactants,
+                             int number_of_products, int *products) {
+    int m;
+
+    hash = fnv_int(hash, number_of_reactants);
+    for (m = 0; m < number_of_reactants; m++)
+        hash = fnv_int(hash, reactants[m]);
+
+    hash = fnv_int(hash, number_of_products);
+    for (m = 0; m < number_of_products; m++)
+        hash = fnv_int(hash, products[m]);
+
+    return hash;
+}
+
+static uint64_t fingerprint(ReactionNetwork *reaction_network, bool rates) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    int i;
+
+    hash = fnv_int(hash, reaction_network->number_of_species);
+    hash = fnv_int(hash, reaction_network->number_of_reactions);
+
+    for (i = 0; i < reaction_network->number_of_reactions; i++) {
+        hash = fnv_reaction(hash,
+                            reaction_network->number_of_reactants[i],
+                            reaction_network->reactants[i],
+                            reaction_network->number_of_products[i],
+                            reaction_network->products[i]);
+        if (rates)
+            hash = fnv_double(hash, reaction_network->rates[i]);
+    }
+
+    return hash;
+}
+
+uint64_t network_fingerprint(ReactionNetwork *reaction_network) {
+    return fingerprint(reaction_network, false);
+}
+
+uint64_t network_fingerprint_with_rates(ReactionNetwork *reaction_network) {
+    return fingerprint(reaction_network, true);
+}
+
+uint64_t reaction_database_fingerprint(sqlite3 *reaction_database) {
+    sqlite3_stmt *stmt;
+    uint64_t hash = FNV_OFFSET_BASIS;
+    int number_of_reactions = 0;
+    int i;
+
+    if (sqlite3_prepare_v2(reaction_database,
+                           "SELECT number_of_species, number_of_reactions "
+                           "FROM metadata;",
+                           -1, &stmt, NULL) != SQLITE_OK)
+        return 0;
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        number_of_reactions = sqlite3_column_int(stmt, 1);
+        hash = fnv_int(hash, sqlite3_column_int(stmt, 0));
+        hash = fnv_int(hash, number_of_reactions);
+    }
+    sqlite3_finalize(stmt);
+
+    // new_reaction_network places each reaction at its id
+    if (sqlite3_prepare_v2(reaction_database,
+                           "SELECT number_of_reactants, number_of_products, "
+                           "reactant_1, reactant_2, product_1, product_2, "
+                           "rate FROM reactions ORDER BY reaction_id;",
+                           -1, &stmt, NULL) != SQLITE_OK)
+        return 0;
+
+    for (i = 0; i < number_of_reactions && sqlite3_step(stmt) == SQLITE_ROW;
+         i++) {
+        int reactants[2] = {sqlite3_column_int(stmt, 2),
+                            sqlite3_column_int(stmt, 3)};
+        int products[2] = {sqlite3_column_int(stmt, 4),
+                           sqlite3_column_int(stmt, 5)};
+
+        hash = fnv_reaction(hash,
+                            (uint8_t) sqlite3_column_int(stmt, 0), reactants,
+                            (uint8_t) sqlite3_column_int(stmt, 1), products);
+        hash = fnv_double(hash, sqlite3_column_double(stmt, 6));
+    }
+    sqlite3_finalize(stmt);
+
+    return hash;
+}
+
+int load_dependency_cache(ReactionNetwork *reaction_network,
+                          char *path,
+                          int64_t *occurrences) {
+
+    int number_of_reactions = reaction_network->number_of_reactions;
+    int i;
+
+    memset(occurrences, 0, number_of_reactions * sizeof(int64_t));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 ||
+        (size_t) file_stat.st_size < sizeof(DependencyCacheHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = file_stat.st_size;
+    char *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+        return -1;
+
+    DependencyCacheHeader *header = (DependencyCacheHeader *) mapping;
+    int number_of_nodes = header->number_of_nodes;
+
+    if (memcmp(header->magic, DEPENDENCY_CACHE_MAGIC, 8) != 0 ||
+        header->number_of_reactions != number_of_reactions ||
+        number_of_nodes < 0 ||
+        number_of_nodes > number_of_reactions ||
+        header->size_of_dependents < 0 ||
+        sizeof(DependencyCacheHeader)
+        + number_of_reactions * sizeof(int64_t)
+        + number_of_nodes * (sizeof(int64_t) + sizeof(int32_t))
+        + header->size_of_dependents * sizeof(int32_t) != size ||
+        header->fingerprint != network_fingerprint(reaction_network)) {
+        munmap(mapping, size);
+        return -1;
+    }
+
+    int64_t *cached_occurrences = (int64_t *) (header + 1);
+    int64_t *node_offsets = cached_occurrences + number_of_reactions;
+    int32_t *node_reactions = (int32_t *) (node_offsets + number_of_nodes);
+    int32_t *dependents = node_reactions + number_of_nodes;
+
+    // the cache is read front to back once below
+    madvise(mapping, size, MADV_WILLNEED);
+
+    // check every node before publishing any of them
+    for (i = 0; i < number_of_nodes; i++) {
+        int reaction = node_reactions[i];
+        int64_t offset = node_offsets[i];
+
+        if (reaction < 0 || reaction >= number_of_reactions ||
+            offset < 0 || offset >= header->size_of_dependents ||
+            dependents[offset] < 0 ||
+            offset + 1 + dependents[offset] > header->size_of_dependents) {
+            munmap(mapping, size);
+            return -1;
+        }
+
+        // solvers index their arrays with the dependents, so a damaged
+        // cache must not get any out of range ones through
+        for (int k = 0; k < dependents[offset]; k++) {
+            int dependent = dependents[offset + 1 + k];
+            if (dependent < 0 || dependent >= number_of_reactions) {
+                munmap(mapping, size);
+                return -1;
+            }
+        }
+    }
+
+    memcpy(occurrences, cached_occurrences,
+           number_of_reactions * sizeof(int64_t));
+
+    for (i = 0; i < number_of_nodes; i++) {
+        int reaction = node_reactions[i];
+        int64_t offset = node_offsets[i];
+
+        atomic_store_explicit(
+            &reaction_network->dependency_graph[reaction].dependents,
+            (Dependents *) (dependents + offset),
+            memory_order_relaxed);
+    }
+
+    reaction_network->dependency_cache_mapping = mapping;
+    reaction_network->dependency_cache_mapping_size = size;
+
+    // prefetch the nodes of reactions which were frequent enough in
+    // previous runs that they would be computed anyway, within the budget
+    size_t budget = reaction_network->dependency_memory_budget;
+    for (i = 0; i < number_of_reactions; i++) {
+        DependentsNode *node = reaction_network->dependency_graph + i;
+        if (occurrences[i] > 0 &&
+            occurrences[i] >= reaction_network->dependency_threshold &&
+            ! atomic_load_explicit(&node->dependents, memory_order_relaxed)) {
+
+            if (budget && atomic_load(&reaction_network->dependency_memory)
+                > budget / 4 * DEPENDENCY_EVICTION_TARGET)
+                break;
+
+            Dependents *prefetched = compute_dependency_node(reaction_network, i);
+            atomic_fetch_add(&reaction_network->dependency_memory,
+                             dependents_size(prefetched));
+            atomic_store_explicit(&node->dependents, prefetched,
+                                  memory_order_relaxed);
+        }
+    }
+
+    return number_of_nodes;
+}
+
+int save_dependency_cache(ReactionNetwork *reaction_network,
+                          char *path,
+                          int64_t *occurrences) {
+
+    int number_of_reactions = reaction_network->number_of_reactions;
+    int i;
+
+    DependencyCacheHeader header;
+    memcpy(header.magic, DEPENDENCY_CACHE_MAGIC, 8);
+    header.fingerprint = network_fingerprint(reaction_network);
+    header.number_of_reactions = number_of_reactions;
+    header.number_of_nodes = 0;
+    header.size_of_dependents = 0;
+
+    int64_t *node_offsets = calloc(number_of_reactions, sizeof(int64_t));
+    int32_t *node_reactions = calloc(number_of_reactions, sizeof(int32_t));
+
+    for (i = 0; i < number_of_reactions; i++) {
+        Dependents *dependents = atomic_load_explicit(
+            &reaction_network->dependency_graph[i].dependents,
+            memory_order_acquire);
+
+        if (dependents) {
+            node_offsets[header.number_of_nodes] = header.size_of_dependents;
+            node_reactions[header.number_of_nodes] = i;
+            header.number_of_nodes++;
+            header.size_of_dependents += 1 + dependents->number_of_dependents;
+        }
+    }
+
+    char temporary_path[4096];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.%d.tmp",
+             path, (int) getpid());
+
+    FILE *file = fopen(temporary_path, "wb");
+    if (! file) {
+        free(node_offsets);
+        free(node_reactions);
+        return -1;
+    }
+
+    bool ok = true;
+    ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(occurrences, sizeof(int64_t), number_of_reactions, file)
+        == (size_t) number_of_reactions;
+    ok = ok && fwrite(node_offsets, sizeof(int64_t), header.number_of_nodes, file)
+        == (size_t) header.number_of_nodes;
+    ok = ok && fwrite(node_reactions, sizeof(int32_t), header.number_of_nodes, file)
+        == (size_t) header.number_of_nodes;
+
+    for (i = 0; ok && i < header.number_of_nodes; i++) {
+        Dependents *dependents = atomic_load_explicit(
+            &reaction_network->dependency_graph[node_reactions[i]].dependents,
+            memory_order_acquire);
+        size_t length = 1 + dependents->number_of_dependents;
+        ok = fwrite(dependents, sizeof(int32_t), length, file) == length;
+    }
+
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(temporary_path, path) == 0;
+
+    if (! ok)
+        remove(temporary_path);
+
+    free(node_offsets);
+    free(node_reactions);
+    return ok ? header.number_of_nodes : -1;
+}
@@ -0,0 +1,68 @@
+#ifndef DEPENDENCY_CACHE_H
+#define DEPENDENCY_CACHE_H
+
+#include "reaction_network.h"
+
+/***************************************************************************/
+/* dependency cache                                                        */
+/* the dependency graph only depends on which species each reaction        */
+/* consumes and produces, so nodes computed by one run can be reused by    */
+/* later runs on the same network. The cache file stores the computed      */
+/* nodes and how many times each reaction fired over all the runs which    */
+/* used it. It is keyed by a fingerprint of the reactants and products of  */
+/* every reaction, so a cache for a different network is ignored.         */
+/*                                                                         */
+/* layout, in native byte order:                                           */
+/* - DependencyCacheHeader                                                 */
+/* - int64_t occurrences[number_of_reactions]                              */
+/* - int64_t node_offsets[number_of_nodes]                                 */
+/* - int32_t node_reactions[number_of_nodes]                               */
+/* - int32_t dependents[size_of_dependents]                                */
+/* the nodes are CSR style: the Dependents block (number of dependents     */
+/* followed by them) of node_reactions[i] starts at                        */
+/* dependents[node_offsets[i]]. The file is memory mapped and the          */
+/* dependency graph points into the mapping, so nothing is copied.         */
+/***************************************************************************/
+
+#define DEPENDENCY_CACHE_MAGIC "RNMCDEP1"
+
+typedef struct dependencyCacheHeader {
+    char magic[8];
+    uint64_t fingerprint;
+    int32_t number_of_reactions;
+    int32_t number_of_nodes;
+    int64_t size_of_dependents; // in int32_t
+} DependencyCacheHeader;
+
+// FNV-1a hash of the reactants and products of every reaction
+uint64_t network_fingerprint(ReactionNetwork *reaction_network);
+
+// network_fingerprint, hashing the rates as well
+uint64_t network_fingerprint_with_rates(ReactionNetwork *reaction_network);
+
+// network_fingerprint_with_rates of the network new_reaction_network
+// would load from reaction_database, reading the reactions table once
+// without building the network. Returns 0 if it can't be read
+uint64_t reaction_database_fingerprint(sqlite3 *reaction_database);
+
+// maps the cache at path and publishes its nodes in the dependency graph.
+// occurrences (number_of_reactions long) is set to the firings recorded
+// in the cache. Then the nodes of reactions which fired at least
+// dependency_threshold times in previous runs but weren't cached are
+// computed up front, while they fit in the dependency memory budget,
+// so set the budget first. Returns the number of nodes loaded, or -1 if
+// there is no usable cache at path (missing, for another network, or with
+// a node out of bounds or with a dependent which isn't a reaction), in
+// which case occurrences is zeroed.
+int load_dependency_cache(ReactionNetwork *reaction_network,
+                          char *path,
+                          int64_t *occurrences);
+
+// writes every computed node and occurrences to path. The file is
+// written next to path and renamed, so concurrent runs sharing a cache
+// never see half a file. Returns the number of nodes written or -1.
+int save_dependency_cache(ReactionNetwork *reaction_network,
+                          char *path,
+                          int64_t *occurrences);
+
+#endif
@@ -112,11 +112,27 @@ Dispatcher *new_dispatcher(
     int number_of_threads,
     int step_cutoff,
     int dependency_threshold,
+    char *dependency_cache_file,
+    size_t dependency_memory_budget,
+    bool reduce,
+    bool renumber,
+    char *shared_network,
+    bool float_times,
+    bool tau_leaping,
+    SolveType solve_type,
+    SamplerType sampler_type,
+    bool calibrate_solver,
     bool logging) {
 
 
     Dispatcher *dispatcher = calloc(1,sizeof(Dispatcher));
-    sqlite3_open(reaction_database_file, &dispatcher->reaction_database);
+
+    // a compiled network holds the reactions and the initial state, so
+    // the reaction database is only opened when it is sqlite
+    bool compiled = is_compiled_network(reaction_database_file);
+    if (! compiled)
+        sqlite3_open(reaction_database_file, &dispatcher->reaction_database);
+
     sqlite3_open(initial_state_database_file, &dispatcher->initial_state_database);
 
     int rc = sqlite3_prepare_v2(
@@ -132,25 +148,185 @@ Dispatcher *new_dispatcher(
         return NULL;
     }
 
-    dispatcher->reaction_network = new_reaction_network(
-        dispatcher->reaction_database,
-        dispatcher->initial_state_database,
-        dependency_threshold
-        );
+    dispatcher->logging = logging;
+
+    // with a shared network, only the process which publishes it loads it
+    int shared_network_fd = -1;
+    uint64_t fingerprint = 0;
+    if (shared_network) {
+        shared_network_fd = create_shared_network(shared_network);
+        // computed the same way by the publisher and the other processes,
+        // from the reaction database they were given
+        fingerprint = shared_network_fingerprint(
+            reaction_database_file,
+            compiled ? NULL : dispatcher->reaction_database);
+    }
+
+    if (! shared_network || shared_network_fd >= 0) {
+        if (compiled) {
+            dispatcher->reaction_network = new_reaction_network_from_compiled(
+                reaction_database_file,
+                dependency_threshold
+                );
+
+            // the initial state and factors are this run's, not the ones
+            // the network was compiled with
+            if (dispatcher->reaction_network &&
+                ! read_image_initial_state(dispatcher->reaction_network,
+                                           dispatcher->initial_state_database,
+                                           reaction_database_file)) {
+                free_reaction_network(dispatcher->reaction_network);
+                dispatcher->reaction_network = NULL;
+            }
+        }
+        else
+            dispatcher->reaction_network = new_reaction_network(
+                dispatcher->reaction_database,
+                dispatcher->initial_state_database,
+                dependency_threshold
+                );
+
+        if (! dispatcher->reaction_network) {
+            if (shared_network_fd >= 0)
+                abandon_shared_network(shared_network_fd, shared_network);
+            return NULL;
+        }
+
+        if (reduce) {
+            char log_buffer[256];
+            int number_of_reactions =
+                dispatcher->reaction_network->number_of_reactions;
+            int number_of_unfireable, number_of_merged;
+
+            if (dispatcher->reaction_network->reaction_ids)
+                sprintf(log_buffer,
+                        "reduction: compiled network is reduced or renumbered\n");
+            else if (reduce_reaction_network(dispatcher->reaction_network,
+                                             &number_of_unfireable,
+                                             &number_of_merged))
+                sprintf(log_buffer,
+                        "reduction: %d -> %d reactions "
+                        "(%d can't fire, %d merged)\n",
+                        number_of_reactions,
+                        dispatcher->reaction_network->number_of_reactions,
+                        number_of_unfireable,
+                        number_of_merged);
+            else
+                sprintf(log_buffer,
+                        "reduction: compiled networks are reduced "
+                        "by RNMC compile --reduce, using it as it is\n");
+
+            dispatcher_log(dispatcher, log_buffer);
+        }
+
+        if (renumber) {
+            char log_buffer[256];
+            double lines = species_reactions_cache_lines(
+                dispatcher->reaction_network);
+
+            if (dispatcher->reaction_network->species_ids)
+                sprintf(log_buffer,
+                        "renumbering: compiled network is renumbered\n");
+            else if (renumber_reaction_network(dispatcher->reaction_network))
+                sprintf(log_buffer,
+                        "renumbering: propensity cache lines per species "
+                        "%.1f -> %.1f\n",
+                        lines,
+                        species_reactions_cache_lines(
+                            dispatcher->reaction_network));
+            else
+                sprintf(log_buffer,
+                        "renumbering: compiled networks are renumbered "
+                        "by RNMC compile --renumber, using it as it is\n");
+
+            dispatcher_log(dispatcher, log_buffer);
+        }
+    }
+
+    if (shared_network) {
+        char log_buffer[256];
+
+        if (shared_network_fd >= 0) {
+            bool published = publish_shared_network(
+                shared_network_fd,
+                shared_network,
+                dispatcher->reaction_network,
+                fingerprint,
+                SHARED_NETWORK_DEFAULT_ARENA_SIZE);
+
+            free_reaction_network(dispatcher->reaction_network);
+            dispatcher->reaction_network = NULL;
+
+            if (! published)
+                return NULL;
+
+            sprintf(log_buffer, "shared network: published %s\n",
+                    shared_network);
+            dispatcher_log(dispatcher, log_buffer);
+        }
+
+        // the network is reduced or renumbered if the publisher did so
+        dispatcher->reaction_network = attach_shared_network(
+            shared_network,
+            fingerprint,
+            dispatcher->initial_state_database,
+            dependency_threshold);
+
+        if (! dispatcher->reaction_network)
+            return NULL;
+
+        sprintf(log_buffer, "shared network: attached to %s\n",
+                shared_network);
+        dispatcher_log(dispatcher, log_buffer);
+    }
 
     dispatcher->history_queue = new_history_queue();
     dispatcher->seed_queue = new_seed_queue(number_of_simulations, base_seed);
     dispatcher->number_of_threads = number_of_threads;
-    dispatcher->running = calloc(number_of_threads, sizeof(bool));
+    dispatcher->running = calloc(number_of_threads, sizeof(atomic_bool));
 
     dispatcher->threads = calloc(
         dispatcher->number_of_threads,
         sizeof(pthread_t)
         );
 
-    dispatcher->logging = logging;
+    dispatcher->chunk_pools = calloc(number_of_threads, sizeof(ChunkPool *));
+    for (int i = 0; i < number_of_threads; i++)
+        dispatcher->chunk_pools[i] = new_chunk_pool();
+
     dispatcher->step_cutoff = step_cutoff;
+    dispatcher->tau_leaping = tau_leaping;
+    dispatcher->float_times = float_times;
+    dispatcher->solve_type = solve_type;
+    dispatcher->sampler_type = sampler_type;
+    dispatcher->calibrate_solver = calibrate_solver;
     dispatcher->start_time = time(NULL);
+    dispatcher->dependency_cache_file = dependency_cache_file;
+
+    // one reader per simulation thread and one for calibration
+    set_dependency_memory_budget(
+        dispatcher->reaction_network,
+        dependency_memory_budget,
+        number_of_threads + 1);
+
+    if (dependency_cache_file) {
+        dispatcher->reaction_occurrences = calloc(
+            dispatcher->reaction_network->number_of_reactions,
+            sizeof(int64_t));
+
+        int number_of_nodes = load_dependency_cache(
+            dispatcher->reaction_network,
+            dependency_cache_file,
+            dispatcher->reaction_occurrences);
+
+        char log_buffer[256];
+        if (number_of_nodes < 0)
+            sprintf(log_buffer, "dependency cache: starting a new cache\n");
+        else
+            sprintf(log_buffer, "dependency cache: loaded %d nodes\n",
+                    number_of_nodes);
+        dispatcher_log(dispatcher, log_buffer);
+    }
 
     return dispatcher;
 }
@@ -162,8 +338,12 @@ void free_dispatcher(Dispatcher *dispatcher) {
     free_reaction_network(dispatcher->reaction_network);
     free_history_queue(dispatcher->history_queue);
     free_seed_queue(dispatcher->seed_queue);
+    for (int i = 0; i < dispatcher->number_of_threads; i++)
+        free_chunk_pool(dispatcher->chunk_pools[i]);
+    free(dispatcher->chunk_pools);
     free(dispatcher->threads);
     free(dispatcher->running);
+    free(dispatcher->reaction_occurrences);
     free(dispatcher);
 }
 
@@ -211,15 +391,44 @@ void run_dispatcher(Dispatcher *dispatcher) {
             dispatcher->reaction_network->dependency_threshold);
     dispatcher_log(dispatcher, log_buffer);
 
+    if (dispatcher->reaction_network->dependency_memory_budget) {
+        sprintf(log_buffer, "dependency memory budget: %zu bytes\n",
+                dispatcher->reaction_network->dependency_memory_budget);
+        dispatcher_log(dispatcher, log_buffer);
+    }
+
+    sprintf(log_buffer, "tau leaping: %s\n",
+            dispatcher->tau_leaping ? "on" : "off");
+    dispatcher_log(dispatcher, log_buffer);
+
+    sprintf(log_buffer, "random number generator: %s\n",
+            sampler_type_names[dispatcher->sampler_type]);
+    dispatcher_log(dispatcher, log_buffer);
+
+    if (dispatcher->calibrate_solver)
+        calibrate_solver(dispatcher);
+
+    sprintf(log_buffer, "solver: %s\n",
+            solve_type_names[dispatcher->solve_type]);
+    dispatcher_log(dispatcher, log_buffer);
+
 
 
     for (i = 0; i < dispatcher->number_of_threads; i++) {
+        // set before the thread starts, so it can't be overwritten
+        // after the thread finishes
+        atomic_init(dispatcher->running + i, true);
+
         simulation = new_simulator_payload(
             dispatcher->reaction_network,
             dispatcher->history_queue,
-            tree,
+            dispatcher->solve_type,
+            dispatcher->sampler_type,
             dispatcher->seed_queue,
             dispatcher->step_cutoff,
+            dispatcher->tau_leaping,
+            dispatcher->chunk_pools[i],
+            dispatcher->float_times,
             dispatcher->running + i
             );
 
@@ -228,8 +437,6 @@ void run_dispatcher(Dispatcher *dispatcher) {
             NULL,
             run_simulator,
             (void *)simulation);
-
-        dispatcher->running[i] = true;
     }
 
 
@@ -237,6 +444,14 @@ void run_dispatcher(Dispatcher *dispatcher) {
 
     while (true) {
 
+        // look at the flags before the queue: a worker queues its last
+        // trajectory before clearing its flag, so if every flag was
+        // clear, an empty queue means every trajectory has been written
+        flag = false;
+        for (i = 0; i < dispatcher->number_of_threads; i++) {
+            flag = flag || atomic_load(dispatcher->running + i);
+        }
+
         // recording trajectories
         seed = get_simulation_history(
             dispatcher->history_queue,
@@ -252,20 +467,30 @@ void run_dispatcher(Dispatcher *dispatcher) {
                 simulation_history, seed);
 
         }
-        else {
-
-            // checking if we have finished
-            flag = false;
-            for (i = 0; i < dispatcher->number_of_threads; i++) {
-                flag = flag || dispatcher->running[i];
-            }
+        else if (! flag)
+            // the only way you get here is if the simulation queue is empty
+            // and all of the workers have finished.
+            break;
+    }
 
-            if (! flag)
-                // the only way you get here is if the simulation queue is empty
-                // and all of the workers have finished.
-                break;
+    // the workers have stopped touching the reaction network,
+    // but wait for them to exit before it gets saved or freed
+    for (i = 0; i < dispatcher->number_of_threads; i++)
+        pthread_join(dispatcher->threads[i], NULL);
 
-        }
+    if (dispatcher->dependency_cache_file) {
+        int number_of_nodes = save_dependency_cache(
+            dispatcher->reaction_network,
+            dispatcher->dependency_cache_file,
+            dispatcher->reaction_occurrences);
+
+        if (number_of_nodes < 0)
+            sprintf(log_buffer, "dependency cache: failed to write %s\n",
+                    dispatcher->dependency_cache_file);
+        else
+            sprintf(log_buffer, "dependency cache: saved %d nodes\n",
+                    number_of_nodes);
+        dispatcher_log(dispatcher, log_buffer);
     }
 
     dispatcher_log(dispatcher, "removing duplicate trajectories...\n");
@@ -275,47 +500,177 @@ void run_dispatcher(Dispatcher *dispatcher) {
     sqlite3_exec(dispatcher->initial_state_database, sql_remove_duplicate_trajectories, 0, 0, 0);
 }
 
+void calibrate_solver(Dispatcher *dispatcher) {
+    char log_buffer[256];
+    struct timespec start, end;
+    double best_steps_per_second = 0.0;
+    int type, seed;
+    int dependency_reader = register_dependency_reader(
+        dispatcher->reaction_network);
+
+    // untimed warm up, so the first solver timed doesn't pay
+    // for filling in the dependency graph
+    for (seed = 1; seed <= CALIBRATION_SEEDS; seed++) {
+        Simulation *simulation = new_simulation(
+            dispatcher->reaction_network, seed, dispatcher->solve_type,
+            dispatcher->sampler_type);
+        simulation->dependency_reader = dependency_reader;
+        run_for(simulation, CALIBRATION_STEPS);
+        free_simulation_history(simulation->history);
+        free_simulation(simulation);
+    }
+
+    for (type = 0; type < NUMBER_OF_SOLVE_TYPES; type++) {
+        long int steps = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (seed = 1; seed <= CALIBRATION_SEEDS; seed++) {
+            Simulation *simulation = new_simulation(
+                dispatcher->reaction_network, seed, type,
+                dispatcher->sampler_type);
+            simulation->dependency_reader = dependency_reader;
+            run_for(simulation, CALIBRATION_STEPS);
+            steps += simulation->step;
+            free_simulation_history(simulation->history);
+            free_simulation(simulation);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec)
+            + 1.0e-9 * (end.tv_nsec - start.tv_nsec);
+        double steps_per_second = steps / seconds;
+
+        sprintf(log_buffer, "calibration: %s %.3e steps per second\n",
+                solve_type_names[type], steps_per_second);
+        dispatcher_log(dispatcher, log_buffer);
+
+        if (steps_per_second > best_steps_per_second) {
+            best_steps_per_second = steps_per_second;
+            dispatcher->solve_type = type;
+        }
+    }
+
+    unregister_dependency_reader(dispatcher->reaction_network, dependency_reader);
+}
+
+static void insert_trajectory_row(
+    Dispatcher *dispatcher,
+    int seed,
+    int step,
+    int reaction,
+    double time) {
+
+    sqlite3_bind_int(dispatcher->insert_trajectory_stmt, 1, seed);
+    sqlite3_bind_int(dispatcher->insert_trajectory_stmt, 2, step);
+    sqlite3_bind_int(dispatcher->insert_trajectory_stmt, 3, reaction);
+    sqlite3_bind_double(dispatcher->insert_trajectory_stmt, 4, time);
+
+    sqlite3_step(dispatcher->insert_trajectory_stmt);
+    sqlite3_reset(dispatcher->insert_trajectory_stmt);
+}
+
+// draws from the seed of the trajectory, so output is reproducible,
+// mixed so that the draws don't follow the simulation's own
+#define MERGED_REACTION_SEED_MIX 0x9e3779b9ul
+
 void record_simulation_history(
     Dispatcher *dispatcher,
     SimulationHistory *simulation_history,
     int seed
     ) {
 
+    ReactionNetwork *reaction_network = dispatcher->reaction_network;
     int count = 0;
-    int i;
-    int rc;
-    Chunk *chunk = simulation_history->first_chunk;
+    int rows = 0;
+    int j;
+    HistoryCursor cursor;
+    HistoryElement element;
+
+    // which of the reactions merged by reduction each firing was
+    Sampler *merged_sampler = NULL;
+    int *merged_counts = NULL;
+    int merged_counts_size = 0;
+
+    if (reaction_network->merged_offsets)
+        merged_sampler = new_sampler(
+            dispatcher->sampler_type,
+            (unsigned long int) seed ^ MERGED_REACTION_SEED_MIX);
 
     sqlite3_exec(dispatcher->initial_state_database, "BEGIN", 0, 0, 0);
 
-    while (chunk) {
-        for (i = 0; i < chunk->next_free_index; i++) {
+    start_history_cursor(&cursor, simulation_history);
+    while (next_history_element(&cursor, &element)) {
+
+        int reaction = element.reaction;
+        int reaction_count = element.count;
+        int number_of_merged = number_of_merged_reactions(
+            reaction_network, reaction);
+
+        if (number_of_merged == 1)
+            insert_trajectory_row(
+                dispatcher, seed, count,
+                database_reaction_id(reaction_network, reaction),
+                element.time);
 
+        else if (reaction_count == 1)
+            insert_trajectory_row(
+                dispatcher, seed, count,
+                reaction_network->merged_reactions[
+                    sample_merged_reaction(reaction_network, reaction,
+                                           merged_sampler)],
+                element.time);
 
-            sqlite3_bind_int(dispatcher->insert_trajectory_stmt, 1, seed);
-            sqlite3_bind_int(dispatcher->insert_trajectory_stmt, 2, count);
+        else {
+            // a tau leaping row, split among the merged reactions
+            // firing by firing, with a row for each which fired
+            int first = reaction_network->merged_offsets[reaction];
+            int step = count;
+
+            if (number_of_merged > merged_counts_size) {
+                free(merged_counts);
+                merged_counts = calloc(number_of_merged, sizeof(int));
+                merged_counts_size = number_of_merged;
+            }
+            memset(merged_counts, 0, number_of_merged * sizeof(int));
 
-            sqlite3_bind_int(dispatcher->insert_trajectory_stmt, 3,
-                             chunk->data[i].reaction);
+            for (j = 0; j < reaction_count; j++)
+                merged_counts[sample_merged_reaction(
+                                  reaction_network, reaction,
+                                  merged_sampler) - first]++;
 
-            sqlite3_bind_double(dispatcher->insert_trajectory_stmt, 4,
-                             chunk->data[i].time);
+            for (j = 0; j < number_of_merged; j++) {
+                if (merged_counts[j] == 0)
+                    continue;
 
-            rc = sqlite3_step(dispatcher->insert_trajectory_stmt);
-            sqlite3_reset(dispatcher->insert_trajectory_stmt);
-            count += 1;
+                insert_trajectory_row(
+                    dispatcher, seed, step,
+                    reaction_network->merged_reactions[first + j],
+                    element.time);
 
-            if (count % TRANSACTION_SIZE == 0) {
-                sqlite3_exec(dispatcher->initial_state_database, "COMMIT", 0, 0, 0);
-                sqlite3_exec(dispatcher->initial_state_database, "BEGIN", 0, 0, 0);
+                step += merged_counts[j];
             }
+        }
 
+        // step counts reactions, so a row aggregating several firings
+        // (tau leaping) is followed by a gap in step
+        count += reaction_count;
+
+        if (dispatcher->reaction_occurrences)
+            dispatcher->reaction_occurrences[reaction] += reaction_count;
+        rows += 1;
+
+        if (rows % TRANSACTION_SIZE == 0) {
+            sqlite3_exec(dispatcher->initial_state_database, "COMMIT", 0, 0, 0);
+            sqlite3_exec(dispatcher->initial_state_database, "BEGIN", 0, 0, 0);
         }
-        chunk = chunk->next_chunk;
     }
 
     sqlite3_exec(dispatcher->initial_state_database, "COMMIT", 0, 0, 0);
 
+    if (merged_sampler)
+        free_sampler(merged_sampler);
+    free(merged_counts);
+
     // free simulation history once we have inserted it into the db
     free_simulation_history(simulation_history);
 }
@@ -326,50 +681,92 @@ SimulatorPayload *new_simulator_payload(
     ReactionNetwork *reaction_network,
     HistoryQueue *history_queue,
     SolveType type,
+    SamplerType sampler_type,
     SeedQueue *seed_queue,
     int step_cutoff,
-    bool *running
+    bool tau_leaping,
+    ChunkPool *chunk_pool,
+    bool float_times,
+    atomic_bool *running
     ) {
 
     SimulatorPayload *simulator_payload = calloc(1, sizeof(SimulatorPayload));
     simulator_payload->reaction_network = reaction_network;
     simulator_payload->history_queue = history_queue;
     simulator_payload->type = type;
+    simulator_payload->sampler_type = sampler_type;
     simulator_payload->seed_queue = seed_queue;
     simulator_payload->step_cutoff = step_cutoff;
+    simulator_payload->tau_leaping = tau_leaping;
+    simulator_payload->chunk_pool = chunk_pool;
+    simulator_payload->float_times = float_times;
     simulator_payload->running = running;
     return simulator_payload;
 }
 
 void free_simulator_payload(SimulatorPayload *simulator_payload) {
-    // reaction network, seed queue and history queue
+    // reaction network, seed queue, history queue and chunk pool
     // get freed as part of the dispatcher
     free(simulator_payload);
 }
 
 void *run_simulator(void *sp) {
     SimulatorPayload *simulator_payload = (SimulatorPayload *) sp;
+    int dependency_reader = register_dependency_reader(
+        simulator_payload->reaction_network);
+
+    // one simulation per thread, reset for every seed. The initial solver
+    // is never updated, resetting copies it into the simulation's solver
+    Simulation *simulation = NULL;
+    Solve *initial_solver = NULL;
+
     unsigned long int seed = get_seed(simulator_payload->seed_queue);
     while (seed > 0) {
-        Simulation *simulation = new_simulation(
-            simulator_payload->reaction_network,
-            seed,
-            simulator_payload->type);
+        if (! simulation) {
+            simulation = new_simulation(
+                simulator_payload->reaction_network,
+                seed,
+                simulator_payload->type,
+                simulator_payload->sampler_type);
+            simulation->dependency_reader = dependency_reader;
+            set_history_format(simulation,
+                               simulator_payload->chunk_pool,
+                               simulator_payload->float_times);
+
+            initial_solver = new_solve(
+                simulator_payload->type,
+                simulator_payload->sampler_type,
+                seed,
+                simulator_payload->reaction_network,
+                simulation->state);
+        }
+        else
+            reset_simulation(simulation, initial_solver, seed);
 
-        run_for(simulation, simulator_payload->step_cutoff);
+        if (simulator_payload->tau_leaping)
+            run_for_tau_leaping(simulation, simulator_payload->step_cutoff);
+        else
+            run_for(simulation, simulator_payload->step_cutoff);
 
         insert_simulation_history(
             simulator_payload->history_queue,
             simulation->history,
             seed);
 
+        seed = get_seed(simulator_payload->seed_queue);
+    }
 
+    if (simulation) {
         free_simulation(simulation);
-        seed = get_seed(simulator_payload->seed_queue);
+        free_solve(initial_solver);
     }
 
+    unregister_dependency_reader(
+        simulator_payload->reaction_network,
+        dependency_reader);
+
     // tell the dispatcher that we are finished
-    *simulator_payload->running = false;
+    atomic_store(simulator_payload->running, false);
 
 
     free_simulator_payload(simulator_payload);
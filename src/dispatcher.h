@@ -7,6 +7,12 @@
 #include <time.h>
 #include "reaction_network.h"
 #include "simulation.h"
+#include "tau_leaping.h"
+#include "dependency_cache.h"
+#include "compiled_network.h"
+#include "reduction.h"
+#include "renumbering.h"
+#include "shared_network.h"
 
 
 typedef struct seedQueue {
@@ -63,10 +69,23 @@ typedef struct dispatcher {
     SeedQueue *seed_queue;
     int number_of_threads; // length of threads array
     pthread_t *threads;
-    bool *running;   // array of bools indicating which threads are still running
+    atomic_bool *running;   // array of bools indicating which threads are still running
+    // a chunk pool per thread for its histories. Owned by the dispatcher,
+    // since it frees the last histories after the threads have finished
+    ChunkPool **chunk_pools;
     int step_cutoff; // step cutoff
+    bool tau_leaping; // use approximate tau leaping instead of exact steps
+    bool float_times; // encode history times as float differences
+    SolveType solve_type;
+    SamplerType sampler_type;
+    // time each solver on the network before starting and use the fastest
+    bool calibrate_solver;
     bool logging; // logging enabled
     long int start_time;
+    char *dependency_cache_file; // NULL if not using a dependency cache
+    // firings of each reaction in this run and the previous runs
+    // recorded in the dependency cache
+    int64_t *reaction_occurrences;
 } Dispatcher;
 
 Dispatcher *new_dispatcher(
@@ -77,6 +96,16 @@ Dispatcher *new_dispatcher(
     int number_of_threads,
     int step_cutoff,
     int dispatcher_threshold,
+    char *dependency_cache_file,
+    size_t dependency_memory_budget,
+    bool reduce,
+    bool renumber,
+    char *shared_network,
+    bool float_times,
+    bool tau_leaping,
+    SolveType solve_type,
+    SamplerType sampler_type,
+    bool calibrate_solver,
     bool logging);
 
 void free_dispatcher(Dispatcher *dispatcher);
@@ -87,6 +116,14 @@ void run_dispatcher(Dispatcher *dispatcher);
 // to dispatcher_log
 void dispatcher_log(Dispatcher *dispatcher, char *message);
 
+// number of seeds and steps per seed used to time each solver
+#define CALIBRATION_SEEDS 3
+#define CALIBRATION_STEPS 2000
+
+// run a few short simulations with each solver and set
+// dispatcher->solve_type to the one with the most steps per second
+void calibrate_solver(Dispatcher *dispatcher);
+
 
 #define TRANSACTION_SIZE 10000
 
@@ -100,20 +137,28 @@ typedef struct simulatorPayload {
     ReactionNetwork *reaction_network;
     HistoryQueue *history_queue;
     SolveType type;
+    SamplerType sampler_type;
     SeedQueue *seed_queue;
     int step_cutoff;
+    bool tau_leaping;
+    ChunkPool *chunk_pool;
+    bool float_times;
     // pointer to a bool shared with dispatcher
     // so it can query if we are still running
-    bool *running;
+    atomic_bool *running;
 } SimulatorPayload;
 
 SimulatorPayload *new_simulator_payload(
     ReactionNetwork *reaction_network,
     HistoryQueue *history_queue,
     SolveType type,
+    SamplerType sampler_type,
     SeedQueue *seed_queue,
     int step_cutoff,
-    bool *running
+    bool tau_leaping,
+    ChunkPool *chunk_pool,
+    bool float_times,
+    atomic_bool *running
     );
 
 void free_simulator_payload(SimulatorPayload *simulator_payload);
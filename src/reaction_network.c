@@ -1,17 +1,16 @@
 #include "reaction_network.h"
+#include <sys/mman.h>
+#include <string.h>
 
 void initialize_dependents_node(DependentsNode *dependents_node) {
-    dependents_node->number_of_dependents = -1;
-    dependents_node->dependents = NULL;
-    dependents_node->number_of_occurrences = 0;
-    pthread_mutex_init(&dependents_node->mutex, NULL);
+    atomic_init(&dependents_node->dependents, NULL);
+    atomic_init(&dependents_node->number_of_occurrences, 0);
 }
 
 void free_dependents_node(DependentsNode *dependents_node) {
   // we don't free dnp because they get initialized as a whole chunk
-  if (dependents_node->dependents)
-    free(dependents_node->dependents);
-  pthread_mutex_destroy(&dependents_node->mutex);
+  free(atomic_load_explicit(&dependents_node->dependents,
+                            memory_order_relaxed));
 }
 
 char sql_get_metadata[] =
@@ -37,12 +36,10 @@ ReactionNetwork *new_reaction_network(
 
 
     sqlite3_stmt *get_metadata_stmt;
-    sqlite3_stmt *get_factors_stmt;
-    sqlite3_stmt *get_initial_state_stmt;
     sqlite3_stmt *get_reactions_stmt;
     int rc;
     int i;
-    int species_index, reaction_index;
+    int reaction_index;
 
 
     rc = sqlite3_prepare_v2(
@@ -59,20 +56,6 @@ ReactionNetwork *new_reaction_network(
     reaction_network->number_of_species = sqlite3_column_int(get_metadata_stmt, 0);
     reaction_network->number_of_reactions = sqlite3_column_int(get_metadata_stmt, 1);
 
-    rc = sqlite3_prepare_v2(
-        initial_state_database, sql_get_factors, -1, &get_factors_stmt, NULL);
-
-    if (rc != SQLITE_OK) {
-        printf("new_reaction_network error %s\n",
-               sqlite3_errmsg(reaction_network_database));
-        return NULL;
-    }
-
-    sqlite3_step(get_factors_stmt);
-    reaction_network->factor_zero = sqlite3_column_double(get_factors_stmt, 0);
-    reaction_network->factor_two = sqlite3_column_double(get_factors_stmt, 1);
-    reaction_network->factor_duplicate = sqlite3_column_double(get_factors_stmt, 2);
-
 
     reaction_network->dependency_threshold = dependency_threshold;
 
@@ -110,6 +93,13 @@ ReactionNetwork *new_reaction_network(
     reaction_network->rates = calloc(
         reaction_network->number_of_reactions, sizeof(double));
 
+    reaction_network->all_reactions = calloc(
+        reaction_network->number_of_reactions, sizeof(int));
+
+    for (i = 0; i < reaction_network->number_of_reactions; i++) {
+      reaction_network->all_reactions[i] = i;
+    }
+
 
     rc = sqlite3_prepare_v2(
         reaction_network_database,
@@ -152,9 +142,46 @@ ReactionNetwork *new_reaction_network(
     }
 
 
-    // allocate initial state
-    reaction_network->initial_state = calloc(
-        reaction_network->number_of_species, sizeof(int));
+    if (! read_initial_state(reaction_network, initial_state_database))
+        return NULL;
+
+
+    initialize_packed_reactions(reaction_network);
+    initialize_species_reactions(reaction_network);
+    initialize_dependency_graph(reaction_network);
+    initialize_propensities(reaction_network);
+
+
+
+    sqlite3_finalize(get_metadata_stmt);
+    sqlite3_finalize(get_reactions_stmt);
+    return reaction_network;
+
+}
+
+bool read_initial_state(ReactionNetwork *reaction_network,
+                        sqlite3 *initial_state_database) {
+    sqlite3_stmt *get_factors_stmt;
+    sqlite3_stmt *get_initial_state_stmt;
+    int number_of_species = reaction_network->number_of_species;
+    int rc;
+    int i;
+    int species_index;
+
+    rc = sqlite3_prepare_v2(
+        initial_state_database, sql_get_factors, -1, &get_factors_stmt, NULL);
+
+    if (rc != SQLITE_OK) {
+        printf("read_initial_state error %s\n",
+               sqlite3_errmsg(initial_state_database));
+        return false;
+    }
+
+    sqlite3_step(get_factors_stmt);
+    reaction_network->factor_zero = sqlite3_column_double(get_factors_stmt, 0);
+    reaction_network->factor_two = sqlite3_column_double(get_factors_stmt, 1);
+    reaction_network->factor_duplicate = sqlite3_column_double(get_factors_stmt, 2);
+    sqlite3_finalize(get_factors_stmt);
 
     rc = sqlite3_prepare_v2(
         initial_state_database,
@@ -164,47 +191,115 @@ ReactionNetwork *new_reaction_network(
         NULL);
 
     if (rc != SQLITE_OK) {
-        printf("new_reaction_network error %s\n",
+        printf("read_initial_state error %s\n",
                sqlite3_errmsg(initial_state_database));
-        return NULL;
+        return false;
+    }
+
+    // allocate initial state
+    reaction_network->initial_state = calloc(number_of_species, sizeof(int));
+
+    // the database has species by their database ids
+    int *internal_species = NULL;
+    if (reaction_network->species_ids) {
+        internal_species = calloc(number_of_species, sizeof(int));
+        for (i = 0; i < number_of_species; i++)
+            internal_species[reaction_network->species_ids[i]] = i;
     }
 
     // fill initial state
-    for (i = 0; i < reaction_network->number_of_species; i++) {
+    for (i = 0; i < number_of_species; i++) {
         sqlite3_step(get_initial_state_stmt);
         species_index = sqlite3_column_int(get_initial_state_stmt,0);
+        if (internal_species)
+            species_index = internal_species[species_index];
         reaction_network->initial_state[species_index] =
             sqlite3_column_int(get_initial_state_stmt,1);
     }
 
-
-    initialize_dependency_graph(reaction_network);
-    initialize_propensities(reaction_network);
-
+    free(internal_species);
+    sqlite3_finalize(get_initial_state_stmt);
+    return true;
+}
 
 
-    sqlite3_finalize(get_metadata_stmt);
-    sqlite3_finalize(get_reactions_stmt);
-    sqlite3_finalize(get_initial_state_stmt);
-    return reaction_network;
+static inline bool in_mapping(void *pointer, char *mapping, size_t size) {
+    return mapping &&
+        (char *) pointer >= mapping &&
+        (char *) pointer < mapping + size;
+}
 
+// nodes from the dependency cache or the arena of a shared network. They
+// aren't counted against the memory budget, evicted or freed
+static inline bool is_mapped_dependents(ReactionNetwork *reaction_network,
+                                        Dependents *dependents) {
+    return in_mapping(dependents,
+                      reaction_network->dependency_cache_mapping,
+                      reaction_network->dependency_cache_mapping_size) ||
+        in_mapping(dependents,
+                   reaction_network->network_mapping,
+                   reaction_network->network_mapping_size);
 }
 
+static void free_unless_mapped(ReactionNetwork *reaction_network,
+                               void *array) {
+    if (! in_mapping(array,
+                     reaction_network->network_mapping,
+                     reaction_network->network_mapping_size))
+        free(array);
+}
 
 void free_reaction_network(ReactionNetwork *reaction_network) {
-    free(reaction_network->number_of_reactants);
-    free(reaction_network->reactants[0]);
+    free_unless_mapped(reaction_network, reaction_network->number_of_reactants);
+    free_unless_mapped(reaction_network, reaction_network->reactants[0]);
+    free_unless_mapped(reaction_network, reaction_network->number_of_products);
+    free_unless_mapped(reaction_network, reaction_network->products[0]);
+    free_unless_mapped(reaction_network, reaction_network->rates);
+    free_unless_mapped(reaction_network, reaction_network->packed_reactions);
+    free_unless_mapped(reaction_network, reaction_network->all_reactions);
+    free_unless_mapped(reaction_network,
+                       reaction_network->species_reactions_offsets);
+    free_unless_mapped(reaction_network, reaction_network->species_reactions);
+    free_unless_mapped(reaction_network, reaction_network->initial_state);
+    free_unless_mapped(reaction_network, reaction_network->initial_propensities);
+    free_unless_mapped(reaction_network, reaction_network->reaction_ids);
+    free_unless_mapped(reaction_network, reaction_network->species_ids);
+    free_unless_mapped(reaction_network, reaction_network->merged_offsets);
+    free_unless_mapped(reaction_network, reaction_network->merged_reactions);
+    free_unless_mapped(reaction_network, reaction_network->merged_shares);
+
+    // row pointers are allocated either way
     free(reaction_network->reactants);
-    free(reaction_network->number_of_products);
-    free(reaction_network->products[0]);
     free(reaction_network->products);
-    free(reaction_network->rates);
-    free(reaction_network->initial_state);
-    free(reaction_network->initial_propensities);
 
     int i; // reaction index
-    for (i = 0; i < reaction_network->number_of_reactions; i++)
+
+    for (i = 0; i < reaction_network->number_of_reactions; i++) {
+        Dependents *dependents = atomic_load_explicit(
+            &reaction_network->dependency_graph[i].dependents,
+            memory_order_relaxed);
+
+        // mapped nodes are freed with their mapping
+        if (is_mapped_dependents(reaction_network, dependents))
+            continue;
+
         free_dependents_node(reaction_network->dependency_graph + i);
+    }
+
+    for (i = 0; i < reaction_network->number_of_retired; i++)
+        free(reaction_network->retired_dependents[i]);
+
+    free(reaction_network->retired_dependents);
+    free(reaction_network->retired_epochs);
+    free(reaction_network->dependency_readers);
+
+    if (reaction_network->dependency_cache_mapping)
+        munmap(reaction_network->dependency_cache_mapping,
+               reaction_network->dependency_cache_mapping_size);
+
+    if (reaction_network->network_mapping)
+        munmap(reaction_network->network_mapping,
+               reaction_network->network_mapping_size);
 
     free(reaction_network->dependency_graph);
 
@@ -212,91 +307,432 @@ void free_reaction_network(ReactionNetwork *reaction_network) {
 
 }
 
-DependentsNode *get_dependency_node(ReactionNetwork *reaction_network, int index) {
+// publishes a node from the arena of a shared network in our graph
+static Dependents *publish_shared_dependents(DependentsNode *node,
+                                             Dependents *shared) {
+    Dependents *expected = NULL;
+    if (atomic_compare_exchange_strong_explicit(
+            &node->dependents,
+            &expected,
+            shared,
+            memory_order_release,
+            memory_order_acquire))
+        return shared;
+
+    return expected;
+}
+
+// copies dependents to the arena of a shared network and publishes them
+// for every process. Returns the shared copy, which may be one another
+// process published first, or NULL if the arena is full
+static Dependents *share_dependents(ReactionNetwork *reaction_network,
+                                    int index,
+                                    Dependents *dependents) {
+    // 8 byte aligned, so offsets of nodes stay aligned
+    uint64_t size = (dependents_size(dependents) + 7) / 8 * 8;
+    uint64_t offset = atomic_fetch_add_explicit(
+        reaction_network->shared_arena_used, size, memory_order_relaxed);
+
+    if (offset + size > reaction_network->shared_arena_end)
+        return NULL;
+
+    Dependents *shared = (Dependents *) (reaction_network->network_mapping + offset);
+    memcpy(shared, dependents, dependents_size(dependents));
+
+    // the space is wasted if another process won, which only happens when
+    // both computed the node at the same time
+    uint64_t expected = 0;
+    if (! atomic_compare_exchange_strong_explicit(
+            reaction_network->shared_node_offsets + index,
+            &expected,
+            offset,
+            memory_order_release,
+            memory_order_acquire))
+        offset = expected;
+
+    return (Dependents *) (reaction_network->network_mapping + offset);
+}
+
+Dependents *get_dependency_node(ReactionNetwork *reaction_network, int index) {
     DependentsNode *node = reaction_network->dependency_graph + index;
 
-    pthread_mutex_lock(&node->mutex);
+    // fast path: no locks, and no writes unless a sweep cleared referenced
+    Dependents *dependents = atomic_load_explicit(
+        &node->dependents, memory_order_acquire);
+
+    if (dependents) {
+        // a second chance for nodes still in use. Loading first keeps the
+        // cache line shared while the bit is set, and without a budget
+        if (reaction_network->dependency_memory_budget &&
+            ! atomic_load_explicit(&node->referenced, memory_order_relaxed))
+            atomic_store_explicit(&node->referenced, true, memory_order_relaxed);
+        return dependents;
+    }
 
-    // if we haven't computed this node
-    // and the reaction has been seen more times than the threshold:
-    // compute it
-    if ( ! node->dependents &&
-         node->number_of_occurrences >= reaction_network->dependency_threshold )
-        compute_dependency_node(reaction_network, index);
+    // another process may have computed it
+    if (reaction_network->shared_node_offsets) {
+        uint64_t offset = atomic_load_explicit(
+            reaction_network->shared_node_offsets + index,
+            memory_order_acquire);
 
-    node->number_of_occurrences++;
-    pthread_mutex_unlock(&node->mutex);
-    return node;
-}
+        if (offset)
+            return publish_shared_dependents(
+                node, (Dependents *) (reaction_network->network_mapping + offset));
+    }
 
+    // if the reaction has been seen more times than the threshold:
+    // compute the node
+    int number_of_occurrences = atomic_fetch_add_explicit(
+        &node->number_of_occurrences, 1, memory_order_relaxed);
 
-void compute_dependency_node(ReactionNetwork *reaction_network, int index) {
+    if (number_of_occurrences < atomic_load_explicit(
+            &reaction_network->current_dependency_threshold,
+            memory_order_relaxed))
+        return NULL;
 
-    DependentsNode *node = reaction_network->dependency_graph + index;
+    dependents = compute_dependency_node(reaction_network, index);
 
-    int number_of_dependents_count = 0;
-    int j; // reaction index
-    int l, m, n; // reactant and product indices
+    if (reaction_network->shared_node_offsets) {
+        Dependents *shared = share_dependents(reaction_network, index, dependents);
+        if (shared) {
+            free(dependents);
+            return publish_shared_dependents(node, shared);
+        }
+    }
 
-    for (j = 0; j < reaction_network->number_of_reactions; j++) {
-        bool flag = false;
+    // if another thread published the node first, use theirs.
+    // both computed the same dependents
+    Dependents *expected = NULL;
+    if (! atomic_compare_exchange_strong_explicit(
+            &node->dependents,
+            &expected,
+            dependents,
+            memory_order_release,
+            memory_order_acquire)) {
+        free(dependents);
+        return expected;
+    }
 
-        for (l = 0; l < reaction_network->number_of_reactants[j]; l++) {
-            for (m = 0; m < reaction_network->number_of_reactants[index]; m++) {
-                if (reaction_network->reactants[j][l] ==
-                    reaction_network->reactants[index][m])
-                    flag = true;
-            }
+    size_t dependency_memory = dependents_size(dependents) +
+        atomic_fetch_add_explicit(
+            &reaction_network->dependency_memory,
+            dependents_size(dependents),
+            memory_order_relaxed);
+
+    size_t budget = reaction_network->dependency_memory_budget;
+    if (budget) {
+        // a new node gets a full turn of the clock before eviction
+        atomic_store_explicit(&node->referenced, true, memory_order_relaxed);
+
+        if (dependency_memory > budget)
+            evict_dependency_nodes(reaction_network);
+        else if (dependency_memory < budget / 2) {
+            int threshold = atomic_load_explicit(
+                &reaction_network->current_dependency_threshold,
+                memory_order_relaxed);
+
+            if (threshold > reaction_network->dependency_threshold)
+                atomic_compare_exchange_strong_explicit(
+                    &reaction_network->current_dependency_threshold,
+                    &threshold,
+                    threshold - 1,
+                    memory_order_relaxed,
+                    memory_order_relaxed);
+        }
+    }
 
-            for (n = 0; n < reaction_network->number_of_products[index]; n++) {
-                if (reaction_network->reactants[j][l] ==
-                    reaction_network->products[index][n])
-                    flag = true;
+    return dependents;
+}
+
+void set_dependency_memory_budget(ReactionNetwork *reaction_network,
+                                  size_t budget,
+                                  int number_of_readers) {
+    reaction_network->dependency_memory_budget = budget;
+
+    if (! budget)
+        return;
+
+    reaction_network->number_of_dependency_readers = number_of_readers;
+    reaction_network->dependency_readers = aligned_alloc(
+        64, number_of_readers * sizeof(DependencyReader));
+
+    for (int i = 0; i < number_of_readers; i++)
+        atomic_init(&reaction_network->dependency_readers[i].epoch,
+                    DEPENDENCY_READER_OFFLINE);
+}
+
+int register_dependency_reader(ReactionNetwork *reaction_network) {
+    if (! reaction_network->dependency_memory_budget)
+        return -1;
+
+    while (true) {
+        for (int i = 0; i < reaction_network->number_of_dependency_readers; i++) {
+            DependencyReader *slot = reaction_network->dependency_readers + i;
+            unsigned long offline = DEPENDENCY_READER_OFFLINE;
+            unsigned long epoch = atomic_load(&reaction_network->dependency_epoch);
+
+            // the fence pairs with the one in evict_dependency_nodes.
+            // either the evictor sees this slot as online, or we see
+            // every node it evicted as gone
+            if (atomic_compare_exchange_strong(&slot->epoch, &offline, epoch)) {
+                atomic_thread_fence(memory_order_seq_cst);
+                return i;
             }
         }
+    }
+}
+
+void unregister_dependency_reader(ReactionNetwork *reaction_network, int reader) {
+    if (reader < 0)
+        return;
+
+    atomic_store_explicit(
+        &reaction_network->dependency_readers[reader].epoch,
+        DEPENDENCY_READER_OFFLINE,
+        memory_order_release);
+}
+
+// free the retired nodes which every reader has stopped using
+static void reclaim_dependency_nodes(ReactionNetwork *reaction_network) {
+    unsigned long oldest_epoch = DEPENDENCY_READER_OFFLINE;
+    int i, j;
+
+    for (i = 0; i < reaction_network->number_of_dependency_readers; i++) {
+        unsigned long epoch = atomic_load(
+            &reaction_network->dependency_readers[i].epoch);
+        if (epoch < oldest_epoch)
+            oldest_epoch = epoch;
+    }
+
+    j = 0;
+    for (i = 0; i < reaction_network->number_of_retired; i++) {
+        if (reaction_network->retired_epochs[i] < oldest_epoch)
+            free(reaction_network->retired_dependents[i]);
+        else {
+            reaction_network->retired_dependents[j] =
+                reaction_network->retired_dependents[i];
+            reaction_network->retired_epochs[j] =
+                reaction_network->retired_epochs[i];
+            j++;
+        }
+    }
 
-        if (flag)
-            number_of_dependents_count++;
+    reaction_network->number_of_retired = j;
+}
+
+static void retire_dependents(ReactionNetwork *reaction_network,
+                              Dependents *dependents,
+                              unsigned long epoch) {
+    if (reaction_network->number_of_retired ==
+        reaction_network->retired_capacity) {
+        reaction_network->retired_capacity =
+            2 * reaction_network->retired_capacity + 64;
+
+        reaction_network->retired_dependents = realloc(
+            reaction_network->retired_dependents,
+            reaction_network->retired_capacity * sizeof(Dependents *));
+
+        reaction_network->retired_epochs = realloc(
+            reaction_network->retired_epochs,
+            reaction_network->retired_capacity * sizeof(unsigned long));
     }
 
-    node->number_of_dependents = number_of_dependents_count;
-    node->dependents = calloc(
-        number_of_dependents_count,
-        sizeof(int));
-
-    int dependents_counter = 0;
-    int current_reaction = 0;
-    while (dependents_counter < number_of_dependents_count) {
-        bool flag = false;
-        for (l = 0;
-             l < reaction_network->number_of_reactants[current_reaction];
-             l++) {
-            for (m = 0; m < reaction_network->number_of_reactants[index]; m++) {
-                if (reaction_network->reactants[current_reaction][l] ==
-                    reaction_network->reactants[index][m])
-                    flag = true;
-            }
+    reaction_network->retired_dependents[reaction_network->number_of_retired] =
+        dependents;
+    reaction_network->retired_epochs[reaction_network->number_of_retired] = epoch;
+    reaction_network->number_of_retired++;
+}
 
-            for (n = 0; n < reaction_network->number_of_products[index]; n++) {
-                if (reaction_network->reactants[current_reaction][l] ==
-                    reaction_network->products[index][n])
-                    flag = true;
-            }
+void evict_dependency_nodes(ReactionNetwork *reaction_network) {
+    // only one thread evicts at a time. The others carry on over budget
+    if (atomic_flag_test_and_set_explicit(
+            &reaction_network->evicting, memory_order_acquire))
+        return;
+
+    int number_of_reactions = reaction_network->number_of_reactions;
+    size_t target = reaction_network->dependency_memory_budget
+        / 4 * DEPENDENCY_EVICTION_TARGET;
+    unsigned long epoch = atomic_load(&reaction_network->dependency_epoch);
+
+    // at most two turns of the clock: the first clears referenced
+    for (int i = 0;
+         i < 2 * number_of_reactions &&
+             atomic_load_explicit(&reaction_network->dependency_memory,
+                                  memory_order_relaxed) > target;
+         i++) {
+
+        DependentsNode *node =
+            reaction_network->dependency_graph + reaction_network->clock_hand;
+
+        reaction_network->clock_hand =
+            (reaction_network->clock_hand + 1) % number_of_reactions;
+
+        Dependents *dependents = atomic_load_explicit(
+            &node->dependents, memory_order_acquire);
+
+        if (! dependents || is_mapped_dependents(reaction_network, dependents))
+            continue;
+
+        // second chance
+        if (atomic_exchange_explicit(&node->referenced, false,
+                                     memory_order_relaxed))
+            continue;
+
+        if (atomic_compare_exchange_strong(&node->dependents, &dependents, NULL)) {
+            // the reaction has to earn its node again
+            atomic_store_explicit(&node->number_of_occurrences, 0,
+                                  memory_order_relaxed);
+            atomic_fetch_sub_explicit(&reaction_network->dependency_memory,
+                                      dependents_size(dependents),
+                                      memory_order_relaxed);
+            retire_dependents(reaction_network, dependents, epoch);
         }
+    }
+
+    // nodes are computed faster than they are reused, so be pickier
+    int threshold = atomic_load_explicit(
+        &reaction_network->current_dependency_threshold, memory_order_relaxed);
+    if (threshold < INT_MAX / 2)
+        atomic_store_explicit(
+            &reaction_network->current_dependency_threshold,
+            2 * threshold + 1,
+            memory_order_relaxed);
+
+    // readers which report an epoch after this one have dropped
+    // every node retired above
+    atomic_fetch_add(&reaction_network->dependency_epoch, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    reclaim_dependency_nodes(reaction_network);
+
+    atomic_flag_clear_explicit(&reaction_network->evicting, memory_order_release);
+}
+
+
+// the dependents of a reaction are the reactions consuming one of its
+// reactants or products. That is the union of at most four lists of the
+// species index, each sorted, so merge them dropping duplicates
+Dependents *compute_dependency_node(ReactionNetwork *reaction_network,
+                                    int index) {
+
+    int *offsets = reaction_network->species_reactions_offsets;
+
+    int species[4];
+    int number_of_species = 0;
+    int position[4], end[4];
+    int number_of_dependents_bound = 0;
+    int k, m, s;
+
+    for (m = 0; m < reaction_network->number_of_reactants[index]; m++)
+        species[number_of_species++] = reaction_network->reactants[index][m];
+
+    for (m = 0; m < reaction_network->number_of_products[index]; m++)
+        species[number_of_species++] = reaction_network->products[index][m];
+
+    // lists of repeated species would only produce duplicates
+    for (k = 0; k < number_of_species; k++) {
+        s = species[k];
+        position[k] = offsets[s];
+        end[k] = offsets[s + 1];
+
+        for (m = 0; m < k; m++)
+            if (species[m] == s)
+                end[k] = position[k];
+
+        number_of_dependents_bound += end[k] - position[k];
+    }
+
+    Dependents *dependents = calloc(
+        1, sizeof(Dependents) + number_of_dependents_bound * sizeof(int));
+
+    int number_of_dependents_count = 0;
+    while (true) {
+        int next = -1;
+        for (k = 0; k < number_of_species; k++)
+            if (position[k] < end[k] &&
+                (next < 0 ||
+                 reaction_network->species_reactions[position[k]] < next))
+                next = reaction_network->species_reactions[position[k]];
+
+        if (next < 0) break;
+
+        dependents->dependents[number_of_dependents_count++] = next;
+
+        for (k = 0; k < number_of_species; k++)
+            if (position[k] < end[k] &&
+                reaction_network->species_reactions[position[k]] == next)
+                position[k]++;
+    }
+
+    dependents->number_of_dependents = number_of_dependents_count;
+
+    // the bound counts reactions consuming several of the species
+    // more than once
+    if (number_of_dependents_count < number_of_dependents_bound)
+        dependents = realloc(dependents, dependents_size(dependents));
+
+    return dependents;
+}
+
+void initialize_species_reactions(ReactionNetwork *reaction_network) {
+    int number_of_species = reaction_network->number_of_species;
+    int i, s; // reaction and species index
+
+    reaction_network->species_reactions_offsets = calloc(
+        number_of_species + 1, sizeof(int));
+    int *offsets = reaction_network->species_reactions_offsets;
+    int *fill = calloc(number_of_species + 1, sizeof(int));
+
+    // count into offsets[s + 1], then prefix sum
+    for (i = 0; i < reaction_network->number_of_reactions; i++) {
+        int *reactants = reaction_network->reactants[i];
+        int number_of_reactants = reaction_network->number_of_reactants[i];
 
-        if (flag) {
-            node->dependents[dependents_counter] = current_reaction;
-            dependents_counter++;
+        if (number_of_reactants > 0)
+            offsets[reactants[0] + 1]++;
+
+        if (number_of_reactants > 1 && reactants[1] != reactants[0])
+            offsets[reactants[1] + 1]++;
+    }
+
+    for (s = 0; s < number_of_species; s++)
+        offsets[s + 1] += offsets[s];
+
+    reaction_network->species_reactions = calloc(
+        offsets[number_of_species], sizeof(int));
+
+    // reactions are visited in increasing order,
+    // so each list comes out sorted
+    for (i = 0; i < reaction_network->number_of_reactions; i++) {
+        int *reactants = reaction_network->reactants[i];
+        int number_of_reactants = reaction_network->number_of_reactants[i];
+
+        if (number_of_reactants > 0) {
+            s = reactants[0];
+            reaction_network->species_reactions[offsets[s] + fill[s]++] = i;
+        }
+
+        if (number_of_reactants > 1 && reactants[1] != reactants[0]) {
+            s = reactants[1];
+            reaction_network->species_reactions[offsets[s] + fill[s]++] = i;
         }
-        current_reaction++;
     }
 
+    free(fill);
 }
 
 void initialize_dependency_graph(ReactionNetwork *reaction_network) {
 
 
     int i; // reaction index
+
+    // no memory budget until set_dependency_memory_budget
+    reaction_network->dependency_memory_budget = 0;
+    atomic_init(&reaction_network->dependency_memory, 0);
+    atomic_init(&reaction_network->current_dependency_threshold,
+                reaction_network->dependency_threshold);
+    atomic_flag_clear(&reaction_network->evicting);
+    atomic_init(&reaction_network->dependency_epoch, 0);
+
     reaction_network->dependency_graph = calloc(
         reaction_network->number_of_reactions,
         sizeof(DependentsNode)
@@ -317,37 +753,173 @@ void initialize_dependency_graph(ReactionNetwork *reaction_network) {
 double compute_propensity(ReactionNetwork *reaction_network,
                          int *state,
                          int reaction) {
-    double p;
-    // zero reactants
-    if (reaction_network->number_of_reactants[reaction] == 0)
-        p = reaction_network->factor_zero
-            * reaction_network->rates[reaction];
-
-    // one reactant
-    else if (reaction_network->number_of_reactants[reaction] == 1)
-        p = state[reaction_network->reactants[reaction][0]]
-            * reaction_network->rates[reaction];
-
-
-    // two reactants
-    else {
-        if (reaction_network->reactants[reaction][0] ==
-            reaction_network->reactants[reaction][1])
-            p = reaction_network->factor_duplicate
-                * reaction_network->factor_two
-                * state[reaction_network->reactants[reaction][0]]
-                * (state[reaction_network->reactants[reaction][0]] - 1)
-                * reaction_network->rates[reaction];
+    return compute_packed_propensity(
+        reaction_network->packed_reactions + reaction, state);
+}
 
-        else
-            p = reaction_network->factor_two
-                * state[reaction_network->reactants[reaction][0]]
-                * state[reaction_network->reactants[reaction][1]]
-                * reaction_network->rates[reaction];
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+// PackedReaction as gather offsets: rate is double 0 of a record,
+// reactants are ints 2 and 3
+#define PACKED_REACTION_DOUBLES 3
+#define PACKED_REACTION_INTS 6
+
+__attribute__((target("avx2")))
+static int compute_propensities_avx2(ReactionNetwork *reaction_network,
+                                     int *state,
+                                     int number_of_reactions,
+                                     int *reactions,
+                                     double *propensities) {
+    double *rates = &reaction_network->packed_reactions[0].rate;
+    int *reactants = (int *) reaction_network->packed_reactions;
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi32(1);
+    int i;
+
+    for (i = 0; i + 4 <= number_of_reactions; i += 4) {
+        __m128i reaction = _mm_loadu_si128((__m128i *) (reactions + i));
+
+        __m256d rate = _mm256_i32gather_pd(
+            rates,
+            _mm_mullo_epi32(reaction, _mm_set1_epi32(PACKED_REACTION_DOUBLES)),
+            8);
+
+        __m128i offset = _mm_mullo_epi32(
+            reaction, _mm_set1_epi32(PACKED_REACTION_INTS));
+        __m128i a = _mm_i32gather_epi32(reactants + 2, offset, 4);
+        __m128i b = _mm_i32gather_epi32(reactants + 3, offset, 4);
 
+        __m128i a_missing = _mm_cmplt_epi32(a, zero);
+        __m128i b_missing = _mm_cmplt_epi32(b, zero);
+
+        __m128i count_a = _mm_i32gather_epi32(state, _mm_max_epi32(a, zero), 4);
+        __m128i count_b = _mm_i32gather_epi32(state, _mm_max_epi32(b, zero), 4);
+
+        // a == b is -1 as an integer, so adding it subtracts 1
+        count_b = _mm_add_epi32(count_b, _mm_cmpeq_epi32(a, b));
+        count_a = _mm_blendv_epi8(count_a, one, a_missing);
+        count_b = _mm_blendv_epi8(count_b, one, b_missing);
+
+        __m256d propensity = _mm256_mul_pd(
+            _mm256_mul_pd(_mm256_cvtepi32_pd(count_a),
+                          _mm256_cvtepi32_pd(count_b)),
+            rate);
+
+        _mm256_storeu_pd(propensities + i, propensity);
     }
 
-    return p;
+    return i;
+}
+
+__attribute__((target("avx512f")))
+static int compute_propensities_avx512(ReactionNetwork *reaction_network,
+                                       int *state,
+                                       int number_of_reactions,
+                                       int *reactions,
+                                       double *propensities) {
+    double *rates = &reaction_network->packed_reactions[0].rate;
+    int *reactants = (int *) reaction_network->packed_reactions;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i one = _mm256_set1_epi32(1);
+    int i;
+
+    for (i = 0; i + 8 <= number_of_reactions; i += 8) {
+        __m256i reaction = _mm256_loadu_si256((__m256i *) (reactions + i));
+
+        __m512d rate = _mm512_i32gather_pd(
+            _mm256_mullo_epi32(reaction,
+                               _mm256_set1_epi32(PACKED_REACTION_DOUBLES)),
+            rates,
+            8);
+
+        __m256i offset = _mm256_mullo_epi32(
+            reaction, _mm256_set1_epi32(PACKED_REACTION_INTS));
+        __m256i a = _mm256_i32gather_epi32(reactants + 2, offset, 4);
+        __m256i b = _mm256_i32gather_epi32(reactants + 3, offset, 4);
+
+        __m256i a_missing = _mm256_cmpgt_epi32(zero, a);
+        __m256i b_missing = _mm256_cmpgt_epi32(zero, b);
+
+        __m256i count_a = _mm256_i32gather_epi32(
+            state, _mm256_max_epi32(a, zero), 4);
+        __m256i count_b = _mm256_i32gather_epi32(
+            state, _mm256_max_epi32(b, zero), 4);
+
+        // a == b is -1 as an integer, so adding it subtracts 1
+        count_b = _mm256_add_epi32(count_b, _mm256_cmpeq_epi32(a, b));
+        count_a = _mm256_blendv_epi8(count_a, one, a_missing);
+        count_b = _mm256_blendv_epi8(count_b, one, b_missing);
+
+        __m512d propensity = _mm512_mul_pd(
+            _mm512_mul_pd(_mm512_cvtepi32_pd(count_a),
+                          _mm512_cvtepi32_pd(count_b)),
+            rate);
+
+        _mm512_storeu_pd(propensities + i, propensity);
+    }
+
+    return i;
+}
+#endif
+
+void compute_propensities(ReactionNetwork *reaction_network,
+                          int *state,
+                          int number_of_reactions,
+                          int *reactions,
+                          double *propensities) {
+    int i = 0;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (__builtin_cpu_supports("avx512f"))
+        i = compute_propensities_avx512(reaction_network, state,
+                                        number_of_reactions, reactions,
+                                        propensities);
+    else if (__builtin_cpu_supports("avx2"))
+        i = compute_propensities_avx2(reaction_network, state,
+                                      number_of_reactions, reactions,
+                                      propensities);
+#endif
+
+    // scalar fallback and the reactions left over from the batches
+    for (; i < number_of_reactions; i++)
+        propensities[i] = compute_packed_propensity(
+            reaction_network->packed_reactions + reactions[i], state);
+}
+
+void initialize_packed_reactions(ReactionNetwork *reaction_network) {
+    reaction_network->packed_reactions = aligned_alloc(
+        64,
+        // aligned_alloc wants a multiple of the alignment
+        (reaction_network->number_of_reactions * sizeof(PackedReaction) + 63)
+        / 64 * 64);
+
+    for (int reaction = 0;
+         reaction < reaction_network->number_of_reactions;
+         reaction++) {
+        PackedReaction *packed = reaction_network->packed_reactions + reaction;
+        int *reactants = reaction_network->reactants[reaction];
+        int *products = reaction_network->products[reaction];
+        int number_of_reactants = reaction_network->number_of_reactants[reaction];
+        int number_of_products = reaction_network->number_of_products[reaction];
+        double rate = reaction_network->rates[reaction];
+
+        if (number_of_reactants == 0)
+            packed->rate = reaction_network->factor_zero * rate;
+        else if (number_of_reactants == 1)
+            packed->rate = rate;
+        else if (reactants[0] == reactants[1])
+            packed->rate = reaction_network->factor_duplicate
+                * reaction_network->factor_two
+                * rate;
+        else
+            packed->rate = reaction_network->factor_two * rate;
+
+        for (int m = 0; m < 2; m++) {
+            packed->reactants[m] = m < number_of_reactants ? reactants[m] : -1;
+            packed->products[m] = m < number_of_products ? products[m] : -1;
+        }
+    }
 }
 
 void initialize_propensities(ReactionNetwork *reaction_network) {
@@ -7,17 +7,75 @@
 #include <sqlite3.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <limits.h>
 
 
+// reactions which depend on a reaction, allocated as one block
+typedef struct dependents {
+    int number_of_dependents;
+    int dependents[];
+} Dependents;
+
+static inline size_t dependents_size(Dependents *dependents) {
+    return sizeof(Dependents) + dependents->number_of_dependents * sizeof(int);
+}
+
+// simulation threads look up nodes without locking. dependents is
+// published once with a compare and swap, after it has been filled in,
+// so a thread which loads a non NULL pointer (with acquire) sees the whole
+// block. Once a node is computed, looking it up doesn't write to it,
+// except to set referenced after an eviction sweep cleared it.
 typedef struct dependentsNode {
-    int number_of_dependents; // number of reactions that depend on current reaction.
-    // number_of_dependents is set to -1 if reaction hasn't been encountered before
-    int *dependents; // reactions which depend on current reaction.
-    // dependents is set to NULL if dependents need to be computed.
-    pthread_mutex_t mutex; // mutex needed because simulation thread initialize dependents
-    int number_of_occurrences; // number of times the reaction has occoured.
+    // NULL if dependents need to be computed.
+    Dependents *_Atomic dependents;
+    // number of times the reaction has occoured before its dependents
+    // were computed. Only used for the threshold, so it is relaxed
+    atomic_int number_of_occurrences;
+    // used since the last eviction sweep passed. Only with a memory budget
+    atomic_bool referenced;
 } DependentsNode;
 
+// slot where a simulation thread reports the last dependency epoch it
+// has seen, on its own cache line
+typedef struct dependencyReader {
+    atomic_ulong epoch;
+    char padding[64 - sizeof(atomic_ulong)];
+} DependencyReader;
+
+#define DEPENDENCY_READER_OFFLINE ULONG_MAX
+
+// everything step needs about a reaction in 24 bytes, so computing a
+// propensity or firing a reaction touches one record instead of the
+// separate arrays in ReactionNetwork. Unused reactant and product slots
+// are -1, which doubles as the kind tag:
+// reactants[0] == -1: no reactants, propensity rate
+// reactants[1] == -1: one reactant, propensity rate * count
+// reactants[0] == reactants[1]: A + A, propensity rate * count * (count - 1)
+// otherwise: A + B, propensity rate * count A * count B
+// rate is premultiplied by factor_zero, factor_two or
+// factor_duplicate * factor_two as appropriate.
+typedef struct packedReaction {
+    double rate;
+    int32_t reactants[2];
+    int32_t products[2];
+} PackedReaction;
+
+// branch free: a missing reactant counts as 1, which leaves the product
+// unchanged, and for A + A, state[b] - 1 is the count of the second A.
+// the batched kernels do the same operations in the same order, so
+// every path gives bit identical propensities.
+static inline double compute_packed_propensity(PackedReaction *reaction,
+                                               int *state) {
+    int a = reaction->reactants[0];
+    int b = reaction->reactants[1];
+
+    int count_a = a < 0 ? 1 : state[a < 0 ? 0 : a];
+    int count_b = b < 0 ? 1 : state[b < 0 ? 0 : b] - (a == b);
+
+    return (double) count_a * (double) count_b * reaction->rate;
+}
+
 // struct for storing the static reaction network state which
 // will be shared across all simulation instances
 
@@ -44,6 +102,9 @@ typedef struct reactionNetwork {
     double factor_duplicate; // rate modifier for reactions of form A + A -> ...
     double *rates; // array storing the rates for each reaction
 
+    // the reactions above packed for step, number_of_reactions long
+    PackedReaction *packed_reactions;
+
 
     int *initial_state; // initial state for all the simulations
 
@@ -52,6 +113,18 @@ typedef struct reactionNetwork {
     double *initial_propensities; // initial propensities for all the reactions
 
 
+    // 0, 1, ..., number_of_reactions - 1. Used when all the propensities
+    // need to be recomputed
+    int *all_reactions;
+
+    // inverted index from species to the reactions consuming them.
+    // the reactions with species s as a reactant are
+    // species_reactions[species_reactions_offsets[s]], ...,
+    // species_reactions[species_reactions_offsets[s + 1] - 1]
+    // in increasing order, each listed once even for A + A -> ...
+    int *species_reactions_offsets;
+    int *species_reactions;
+
     // dependency graph. List of DependencyNodes number_of_reactions long.
     DependentsNode *dependency_graph;
 
@@ -59,23 +132,148 @@ typedef struct reactionNetwork {
     // node in the dependency graph
     int dependency_threshold;
 
+    // memory budget for the dependency graph. When the bytes held in
+    // computed nodes go over dependency_memory_budget, the thread which
+    // noticed evicts nodes with the CLOCK policy: a sweep frees nodes not
+    // referenced since the previous sweep. Each sweep also doubles
+    // current_dependency_threshold, which drifts back down to
+    // dependency_threshold while memory is under half the budget.
+    // Evicted nodes are freed once every reader has passed a step
+    // boundary since the eviction (quiescent state based reclamation).
+    size_t dependency_memory_budget; // 0 if unlimited
+    atomic_size_t dependency_memory; // not counting the dependency cache
+    atomic_int current_dependency_threshold;
+    atomic_flag evicting; // held by the thread evicting nodes
+    int clock_hand; // only used while holding evicting
+    atomic_ulong dependency_epoch;
+    int number_of_dependency_readers;
+    atomic_int next_dependency_reader;
+    DependencyReader *dependency_readers;
+    // evicted nodes not freed yet and the epoch they were evicted in.
+    // only used while holding evicting
+    Dependents **retired_dependents;
+    unsigned long *retired_epochs;
+    int number_of_retired;
+    int retired_capacity;
+
+    // internal id -> id in the database, for networks reduced (see
+    // reduction.h) or renumbered for locality (see renumbering.h).
+    // NULL if ids weren't changed. species_ids is only set by renumbering
+    int *reaction_ids;
+    int *species_ids;
+
+    // true if reduced (see reduction.h) from the initial state the
+    // network was loaded with. Other initial states may need reactions
+    // which were dropped
+    bool reduced;
+
+    // reactions merged by reduction. Reaction r stands for database
+    // reactions merged_reactions[merged_offsets[r]], ...,
+    // merged_reactions[merged_offsets[r + 1] - 1], and merged_shares are
+    // their cumulative shares of its rate. NULL if none were merged
+    int *merged_offsets;
+    int *merged_reactions;
+    double *merged_shares;
+
+    // when loaded from a compiled or shared network, the arrays of the
+    // network point into this mapping, except the row pointers of
+    // reactants and products, the dependency graph, the memory budget
+    // state and, for shared networks, the initial state and propensities.
+    // Arrays outside of it are ours to free. NULL if loaded from sqlite.
+    // See compiled_network.h and shared_network.h
+    char *network_mapping;
+    size_t network_mapping_size;
+
+    // dependency nodes shared with the other processes attached to a
+    // shared network. shared_node_offsets[r] is the offset of the node of
+    // r from network_mapping, or 0 if no process has computed it yet.
+    // Nodes are allocated from the arena, by bumping shared_arena_used up
+    // to shared_arena_end. NULL if the network isn't shared
+    _Atomic uint64_t *shared_node_offsets;
+    _Atomic uint64_t *shared_arena_used;
+    uint64_t shared_arena_end;
+
+    // nodes loaded from a dependency cache point into this read only
+    // mapping. NULL if no cache was loaded. See dependency_cache.h
+    char *dependency_cache_mapping;
+    size_t dependency_cache_mapping_size;
+
 } ReactionNetwork;
 
+// the id of an internal reaction in the database
+static inline int database_reaction_id(ReactionNetwork *reaction_network,
+                                       int reaction) {
+    return reaction_network->reaction_ids ?
+        reaction_network->reaction_ids[reaction] : reaction;
+}
+
 ReactionNetwork *new_reaction_network(
     sqlite3 *reaction_network_database,
     sqlite3 *initial_state_database,
     int dependency_threshold
     );
 
+// reads the rate factors and the initial state from the initial state
+// database, allocating initial_state. For renumbered networks the species
+// ids in the database are mapped to internal ones. Returns false on error
+bool read_initial_state(ReactionNetwork *reaction_network,
+                        sqlite3 *initial_state_database);
+
 void free_reaction_network(ReactionNetwork *reaction_network);
 
-DependentsNode *get_dependency_node(ReactionNetwork *reaction_network, int index);
+// returns NULL if the dependents of the reaction haven't been computed.
+// with a memory budget, the result is valid until the calling thread's
+// next call to dependency_quiescent
+Dependents *get_dependency_node(ReactionNetwork *reaction_network, int index);
+
+// evict until memory is under DEPENDENCY_EVICTION_TARGET / 4 of the budget
+#define DEPENDENCY_EVICTION_TARGET 3
 
-void compute_dependency_node(ReactionNetwork *reaction_network, int reaction);
+// CLOCK sweep over the dependency graph, see dependency_memory_budget.
+// called by get_dependency_node when a new node puts memory over budget
+void evict_dependency_nodes(ReactionNetwork *reaction_network);
+
+// number_of_readers is the number of threads which may hold dependents
+// at the same time. Call before simulations start
+void set_dependency_memory_budget(ReactionNetwork *reaction_network,
+                                  size_t budget,
+                                  int number_of_readers);
+
+// with a memory budget, every thread calling get_dependency_node takes a
+// reader slot and reports when it holds no dependents. Without one, these
+// do nothing and register_dependency_reader returns -1
+int register_dependency_reader(ReactionNetwork *reaction_network);
+void unregister_dependency_reader(ReactionNetwork *reaction_network, int reader);
+
+static inline void dependency_quiescent(ReactionNetwork *reaction_network,
+                                        int reader) {
+    DependencyReader *slot = reaction_network->dependency_readers + reader;
+    unsigned long epoch = atomic_load_explicit(
+        &reaction_network->dependency_epoch, memory_order_acquire);
+
+    // only write when there has been an eviction since the last report
+    if (atomic_load_explicit(&slot->epoch, memory_order_relaxed) != epoch)
+        atomic_store_explicit(&slot->epoch, epoch, memory_order_release);
+}
+
+// computes the dependents of a reaction without publishing them
+Dependents *compute_dependency_node(ReactionNetwork *reaction_network,
+                                    int reaction);
 void initialize_dependency_graph(ReactionNetwork *reaction_network);
+void initialize_species_reactions(ReactionNetwork *reaction_network);
+void initialize_packed_reactions(ReactionNetwork *reaction_network);
 
 
 double compute_propensity(ReactionNetwork *rnp, int *state, int reaction);
+
+// propensities[i] = compute_propensity(reaction_network, state, reactions[i])
+// for i < number_of_reactions. Uses AVX-512 or AVX2 gathers when the cpu
+// has them, 8 or 4 reactions at a time.
+void compute_propensities(ReactionNetwork *reaction_network,
+                          int *state,
+                          int number_of_reactions,
+                          int *reactions,
+                          double *propensities);
 void initialize_propensities(ReactionNetwork *rnp);
 
 
@@ -0,0 +1,298 @@
+#include "reduction.h"
+#include <string.h>
+
+// reactants and products in increasing order, unused slots -1, so
+// reactions with the same reactants and products have equal keys
+typedef struct reactionKey {
+    int reactants[2];
+    int products[2];
+    int reaction;
+} ReactionKey;
+
+static ReactionKey reaction_key(ReactionNetwork *reaction_network, int reaction) {
+    ReactionKey key;
+    int m;
+
+    for (m = 0; m < 2; m++) {
+        key.reactants[m] = m < reaction_network->number_of_reactants[reaction] ?
+            reaction_network->reactants[reaction][m] : -1;
+        key.products[m] = m < reaction_network->number_of_products[reaction] ?
+            reaction_network->products[reaction][m] : -1;
+    }
+
+    // -1 sorts first, which is fine as long as it is consistent
+    if (key.reactants[0] > key.reactants[1]) {
+        int swap = key.reactants[0];
+        key.reactants[0] = key.reactants[1];
+        key.reactants[1] = swap;
+    }
+
+    if (key.products[0] > key.products[1]) {
+        int swap = key.products[0];
+        key.products[0] = key.products[1];
+        key.products[1] = swap;
+    }
+
+    key.reaction = reaction;
+    return key;
+}
+
+static int compare_species(const ReactionKey *x, const ReactionKey *y) {
+    for (int m = 0; m < 2; m++) {
+        if (x->reactants[m] != y->reactants[m])
+            return x->reactants[m] < y->reactants[m] ? -1 : 1;
+        if (x->products[m] != y->products[m])
+            return x->products[m] < y->products[m] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// by species, then by reaction, so each group starts with its lowest id
+static int compare_keys(const void *a, const void *b) {
+    const ReactionKey *x = a;
+    const ReactionKey *y = b;
+    int order = compare_species(x, y);
+
+    if (order)
+        return order;
+
+    return (x->reaction > y->reaction) - (x->reaction < y->reaction);
+}
+
+// fireable[r] is set if reaction r can fire at some point starting from
+// the initial state. A species is assumed plentiful once some reaction
+// which can fire produces it, which can only keep reactions
+static void find_fireable_reactions(ReactionNetwork *reaction_network,
+                                    bool *fireable) {
+    int number_of_species = reaction_network->number_of_species;
+    int number_of_reactions = reaction_network->number_of_reactions;
+    int *offsets = reaction_network->species_reactions_offsets;
+    int i, k, m;
+
+    // reactant conditions each reaction is still missing. A species is
+    // enough for a single reactant or A + B once present, and for A + A
+    // once there are two
+    int *missing = calloc(number_of_reactions, sizeof(int));
+    bool *present = calloc(number_of_species, sizeof(bool));
+    bool *plentiful = calloc(number_of_species, sizeof(bool));
+    int *queue = calloc(number_of_reactions, sizeof(int));
+    int head = 0;
+    int tail = 0;
+
+    for (i = 0; i < number_of_species; i++) {
+        present[i] = reaction_network->initial_state[i] > 0;
+        plentiful[i] = reaction_network->initial_state[i] > 1;
+    }
+
+    for (i = 0; i < number_of_reactions; i++) {
+        int *reactants = reaction_network->reactants[i];
+        int number_of_reactants = reaction_network->number_of_reactants[i];
+
+        if (number_of_reactants == 2 && reactants[0] == reactants[1])
+            missing[i] = ! plentiful[reactants[0]];
+        else
+            for (m = 0; m < number_of_reactants; m++)
+                missing[i] += ! present[reactants[m]];
+
+        if (reaction_network->rates[i] > 0.0 && missing[i] == 0) {
+            fireable[i] = true;
+            queue[tail++] = i;
+        }
+    }
+
+    // each reaction is queued once, when it becomes fireable
+    while (head < tail) {
+        int reaction = queue[head++];
+
+        for (m = 0; m < reaction_network->number_of_products[reaction]; m++) {
+            int s = reaction_network->products[reaction][m];
+            bool was_present = present[s];
+            bool was_plentiful = plentiful[s];
+
+            if (was_present && was_plentiful)
+                continue;
+
+            present[s] = true;
+            plentiful[s] = true;
+
+            // species_reactions lists each consumer once, even for A + A
+            for (k = offsets[s]; k < offsets[s + 1]; k++) {
+                int consumer = reaction_network->species_reactions[k];
+                int *reactants = reaction_network->reactants[consumer];
+                bool same = reaction_network->number_of_reactants[consumer] == 2
+                    && reactants[0] == reactants[1];
+
+                if ((same && ! was_plentiful) || (! same && ! was_present))
+                    missing[consumer]--;
+
+                if (missing[consumer] == 0 &&
+                    ! fireable[consumer] &&
+                    reaction_network->rates[consumer] > 0.0) {
+                    fireable[consumer] = true;
+                    queue[tail++] = consumer;
+                }
+            }
+        }
+    }
+
+    free(missing);
+    free(present);
+    free(plentiful);
+    free(queue);
+}
+
+bool reduce_reaction_network(ReactionNetwork *reaction_network,
+                             int *number_of_unfireable,
+                             int *number_of_merged) {
+    if (reaction_network->network_mapping || reaction_network->reaction_ids)
+        return false;
+
+    int number_of_reactions = reaction_network->number_of_reactions;
+    int i, j, m;
+
+    bool *fireable = calloc(number_of_reactions, sizeof(bool));
+    find_fireable_reactions(reaction_network, fireable);
+
+    ReactionKey *keys = calloc(number_of_reactions, sizeof(ReactionKey));
+    int number_of_keys = 0;
+    for (i = 0; i < number_of_reactions; i++)
+        if (fireable[i])
+            keys[number_of_keys++] = reaction_key(reaction_network, i);
+
+    *number_of_unfireable = number_of_reactions - number_of_keys;
+
+    qsort(keys, number_of_keys, sizeof(ReactionKey), compare_keys);
+
+    // groups of equal keys become one reaction, with the lowest id
+    int *group_starts = calloc(number_of_keys + 1, sizeof(int));
+    int number_of_groups = 0;
+    for (i = 0; i < number_of_keys; i++)
+        if (i == 0 || compare_species(keys + i - 1, keys + i) != 0)
+            group_starts[number_of_groups++] = i;
+    group_starts[number_of_groups] = number_of_keys;
+
+    *number_of_merged = number_of_keys - number_of_groups;
+
+    // the reduced reactions keep the order of the lowest id of each group
+    int *group_of_first = malloc(number_of_reactions * sizeof(int));
+    memset(group_of_first, -1, number_of_reactions * sizeof(int));
+    for (i = 0; i < number_of_groups; i++)
+        group_of_first[keys[group_starts[i]].reaction] = i;
+
+    int *group_order = calloc(number_of_groups, sizeof(int));
+    j = 0;
+    for (i = 0; i < number_of_reactions; i++)
+        if (group_of_first[i] >= 0)
+            group_order[j++] = group_of_first[i];
+
+    int new_number_of_reactions = number_of_groups;
+    uint8_t *number_of_reactants = calloc(new_number_of_reactions, sizeof(uint8_t));
+    uint8_t *number_of_products = calloc(new_number_of_reactions, sizeof(uint8_t));
+    int *reactants_values = calloc(2 * new_number_of_reactions, sizeof(int));
+    int *products_values = calloc(2 * new_number_of_reactions, sizeof(int));
+    double *rates = calloc(new_number_of_reactions, sizeof(double));
+    int *reaction_ids = calloc(new_number_of_reactions, sizeof(int));
+    int *merged_offsets = NULL;
+    int *merged_reactions = NULL;
+    double *merged_shares = NULL;
+
+    if (*number_of_merged) {
+        merged_offsets = calloc(new_number_of_reactions + 1, sizeof(int));
+        merged_reactions = calloc(number_of_keys, sizeof(int));
+        merged_shares = calloc(number_of_keys, sizeof(double));
+    }
+
+    int next_merged = 0;
+    for (i = 0; i < new_number_of_reactions; i++) {
+        int group = group_order[i];
+        int first = keys[group_starts[group]].reaction;
+
+        number_of_reactants[i] = reaction_network->number_of_reactants[first];
+        number_of_products[i] = reaction_network->number_of_products[first];
+        for (m = 0; m < 2; m++) {
+            reactants_values[2 * i + m] = reaction_network->reactants[first][m];
+            products_values[2 * i + m] = reaction_network->products[first][m];
+        }
+        reaction_ids[i] = first;
+
+        for (j = group_starts[group]; j < group_starts[group + 1]; j++)
+            rates[i] += reaction_network->rates[keys[j].reaction];
+
+        if (merged_offsets) {
+            // cumulative shares of the rate, the last one exactly 1
+            double cumulative = 0.0;
+            merged_offsets[i] = next_merged;
+            for (j = group_starts[group]; j < group_starts[group + 1]; j++) {
+                cumulative += reaction_network->rates[keys[j].reaction];
+                merged_reactions[next_merged] = keys[j].reaction;
+                merged_shares[next_merged] = cumulative / rates[i];
+                next_merged++;
+            }
+            merged_shares[next_merged - 1] = 1.0;
+        }
+    }
+
+    if (merged_offsets)
+        merged_offsets[new_number_of_reactions] = next_merged;
+
+    free(reaction_network->number_of_reactants);
+    free(reaction_network->number_of_products);
+    free(reaction_network->reactants[0]);
+    free(reaction_network->products[0]);
+    free(reaction_network->reactants);
+    free(reaction_network->products);
+    free(reaction_network->rates);
+    free(reaction_network->all_reactions);
+    free(reaction_network->packed_reactions);
+    free(reaction_network->species_reactions_offsets);
+    free(reaction_network->species_reactions);
+    free(reaction_network->initial_propensities);
+    free(reaction_network->dependency_graph);
+
+    reaction_network->number_of_reactions = new_number_of_reactions;
+    reaction_network->number_of_reactants = number_of_reactants;
+    reaction_network->number_of_products = number_of_products;
+    reaction_network->rates = rates;
+    reaction_network->reaction_ids = reaction_ids;
+    reaction_network->reduced = true;
+    reaction_network->merged_offsets = merged_offsets;
+    reaction_network->merged_reactions = merged_reactions;
+    reaction_network->merged_shares = merged_shares;
+
+    reaction_network->reactants = calloc(new_number_of_reactions, sizeof(int *));
+    reaction_network->products = calloc(new_number_of_reactions, sizeof(int *));
+    reaction_network->all_reactions = calloc(new_number_of_reactions, sizeof(int));
+    for (i = 0; i < new_number_of_reactions; i++) {
+        reaction_network->reactants[i] = reactants_values + 2 * i;
+        reaction_network->products[i] = products_values + 2 * i;
+        reaction_network->all_reactions[i] = i;
+    }
+
+    // nothing has been computed from the old reactions yet
+    initialize_packed_reactions(reaction_network);
+    initialize_species_reactions(reaction_network);
+    initialize_dependency_graph(reaction_network);
+    initialize_propensities(reaction_network);
+
+    free(fireable);
+    free(keys);
+    free(group_starts);
+    free(group_of_first);
+    free(group_order);
+    return true;
+}
+
+int sample_merged_reaction(ReactionNetwork *reaction_network,
+                           int reaction,
+                           Sampler *sampler) {
+    int first = reaction_network->merged_offsets[reaction];
+    int last = reaction_network->merged_offsets[reaction + 1] - 1;
+    double u = sample_uniform(sampler);
+
+    // groups are small, and the last share is 1
+    while (first < last && reaction_network->merged_shares[first] <= u)
+        first++;
+
+    return first;
+}
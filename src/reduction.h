@@ -0,0 +1,53 @@
+#ifndef REDUCTION_H
+#define REDUCTION_H
+
+#include "reaction_network.h"
+#include "sampler.h"
+
+/***************************************************************************/
+/* reduction                                                               */
+/* generated networks have reactions which can never fire from a given     */
+/* initial state, and reactions listed several times with the same         */
+/* reactants and products. They take solver leaves and show up in          */
+/* dependency nodes all the same.                                          */
+/*                                                                         */
+/* reduce_reaction_network drops                                           */
+/* - reactions with a rate of zero                                         */
+/* - reactions with a reactant which is absent from the initial state and  */
+/*   isn't a product of any reaction which can fire (a fixpoint over the   */
+/*   reactions, starting from the initial state). A + A also needs two     */
+/*   As initially or A to be produced                                      */
+/* and merges reactions with the same reactants and products into one,     */
+/* whose rate is the sum of theirs. This only ever drops reactions which   */
+/* can't fire, and merging doesn't change the propensity of firing any of  */
+/* them, so trajectories are distributed as for the whole network.         */
+/*                                                                         */
+/* the reactions of the reduced network are numbered from 0, and           */
+/* reaction_ids maps them back to the database. When a merged reaction     */
+/* fires, the database reaction written to the trajectory is drawn among   */
+/* those merged, in proportion to their rates.                             */
+/***************************************************************************/
+
+// call right after loading, before renumbering. Networks which are memory
+// mapped can't be reduced, they are reduced when compiling. Returns false
+// if the network wasn't reduced, otherwise sets the number of reactions
+// which can't fire and which were merged into another one
+bool reduce_reaction_network(ReactionNetwork *reaction_network,
+                             int *number_of_unfireable,
+                             int *number_of_merged);
+
+// the number of database reactions reaction stands for
+static inline int number_of_merged_reactions(ReactionNetwork *reaction_network,
+                                             int reaction) {
+    return reaction_network->merged_offsets ?
+        reaction_network->merged_offsets[reaction + 1] -
+        reaction_network->merged_offsets[reaction] : 1;
+}
+
+// one of the database reactions merged into reaction, drawn in proportion
+// to their rates. Returns its index in merged_reactions
+int sample_merged_reaction(ReactionNetwork *reaction_network,
+                           int reaction,
+                           Sampler *sampler);
+
+#endif
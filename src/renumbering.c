@@ -0,0 +1,370 @@
+#include "renumbering.h"
+#include <string.h>
+
+// vertices 0, ..., number_of_species - 1 are species and
+// number_of_species + r is reaction r
+typedef struct bipartiteGraph {
+    int number_of_vertices;
+    int *offsets; // CSR, number_of_vertices + 1 long
+    int *adjacent;
+} BipartiteGraph;
+
+// distinct species taking part in a reaction. Returns how many
+static int reaction_species(ReactionNetwork *reaction_network,
+                            int reaction,
+                            int *species) {
+    int count = 0;
+    int m, k;
+
+    for (m = 0; m < 4; m++) {
+        int s;
+        if (m < 2) {
+            if (m >= reaction_network->number_of_reactants[reaction])
+                continue;
+            s = reaction_network->reactants[reaction][m];
+        } else {
+            if (m - 2 >= reaction_network->number_of_products[reaction])
+                continue;
+            s = reaction_network->products[reaction][m - 2];
+        }
+
+        for (k = 0; k < count && species[k] != s; k++);
+        if (k == count)
+            species[count++] = s;
+    }
+
+    return count;
+}
+
+static BipartiteGraph build_graph(ReactionNetwork *reaction_network) {
+    int number_of_species = reaction_network->number_of_species;
+    int number_of_reactions = reaction_network->number_of_reactions;
+    BipartiteGraph graph;
+    int species[4];
+    int i, k, count;
+
+    graph.number_of_vertices = number_of_species + number_of_reactions;
+    graph.offsets = calloc(graph.number_of_vertices + 1, sizeof(int));
+    int *fill = calloc(graph.number_of_vertices + 1, sizeof(int));
+
+    // count into offsets[v + 1], then prefix sum
+    for (i = 0; i < number_of_reactions; i++) {
+        count = reaction_species(reaction_network, i, species);
+        graph.offsets[number_of_species + i + 1] = count;
+        for (k = 0; k < count; k++)
+            graph.offsets[species[k] + 1]++;
+    }
+
+    for (i = 0; i < graph.number_of_vertices; i++)
+        graph.offsets[i + 1] += graph.offsets[i];
+
+    graph.adjacent = calloc(graph.offsets[graph.number_of_vertices],
+                            sizeof(int));
+
+    for (i = 0; i < number_of_reactions; i++) {
+        int reaction_vertex = number_of_species + i;
+        count = reaction_species(reaction_network, i, species);
+        for (k = 0; k < count; k++) {
+            graph.adjacent[graph.offsets[reaction_vertex]
+                           + fill[reaction_vertex]++] = species[k];
+            graph.adjacent[graph.offsets[species[k]]
+                           + fill[species[k]]++] = reaction_vertex;
+        }
+    }
+
+    free(fill);
+    return graph;
+}
+
+static inline int degree(BipartiteGraph *graph, int vertex) {
+    return graph->offsets[vertex + 1] - graph->offsets[vertex];
+}
+
+// degree in the high bits, so sorting orders by degree and then by vertex
+static inline uint64_t degree_key(BipartiteGraph *graph, int vertex) {
+    return ((uint64_t) degree(graph, vertex) << 32) | (uint32_t) vertex;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// breadth first search from start, writing the vertices reached to queue.
+// level of each vertex reached is set, and must be -1 for the component
+// beforehand. Returns the number of vertices reached, and sets
+// *last_level to the first index of the deepest level in queue
+static int level_search(BipartiteGraph *graph,
+                        int start,
+                        int *level,
+                        int *queue,
+                        int *last_level) {
+    int head = 0;
+    int tail = 0;
+
+    queue[tail++] = start;
+    level[start] = 0;
+    *last_level = 0;
+
+    while (head < tail) {
+        int vertex = queue[head++];
+        for (int k = graph->offsets[vertex]; k < graph->offsets[vertex + 1]; k++) {
+            int next = graph->adjacent[k];
+            if (level[next] < 0) {
+                level[next] = level[vertex] + 1;
+                if (level[next] > level[queue[*last_level]])
+                    *last_level = tail;
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    return tail;
+}
+
+// George and Liu: repeatedly restart from a vertex of smallest degree in
+// the deepest level, while that makes the search deeper
+static int pseudo_peripheral_vertex(BipartiteGraph *graph,
+                                    int start,
+                                    int *level,
+                                    int *queue) {
+    int last_level;
+    int depth = -1;
+
+    while (true) {
+        int reached = level_search(graph, start, level, queue, &last_level);
+        int new_depth = level[queue[reached - 1]];
+
+        int candidate = queue[last_level];
+        for (int i = last_level; i < reached; i++)
+            if (degree(graph, queue[i]) < degree(graph, candidate))
+                candidate = queue[i];
+
+        for (int i = 0; i < reached; i++)
+            level[queue[i]] = -1;
+
+        if (new_depth <= depth)
+            return start;
+
+        depth = new_depth;
+        start = candidate;
+    }
+}
+
+// reverse Cuthill-McKee order of every vertex
+static int *reverse_cuthill_mckee(BipartiteGraph *graph) {
+    int number_of_vertices = graph->number_of_vertices;
+    int *order = calloc(number_of_vertices, sizeof(int));
+    int *level = malloc(number_of_vertices * sizeof(int));
+    int *queue = calloc(number_of_vertices, sizeof(int));
+    bool *visited = calloc(number_of_vertices, sizeof(bool));
+    uint64_t *keys = calloc(number_of_vertices, sizeof(uint64_t));
+    int head = 0;
+    int tail = 0;
+    int i, k;
+
+    memset(level, -1, number_of_vertices * sizeof(int));
+
+    // components are started from their vertex of smallest degree
+    int *by_degree = calloc(number_of_vertices, sizeof(int));
+    for (i = 0; i < number_of_vertices; i++)
+        keys[i] = degree_key(graph, i);
+    qsort(keys, number_of_vertices, sizeof(uint64_t), compare_keys);
+    for (i = 0; i < number_of_vertices; i++)
+        by_degree[i] = (int) (uint32_t) keys[i];
+
+    for (i = 0; i < number_of_vertices; i++) {
+        if (visited[by_degree[i]])
+            continue;
+
+        int start = pseudo_peripheral_vertex(graph, by_degree[i], level, queue);
+        order[tail++] = start;
+        visited[start] = true;
+
+        // order is the queue of the search. The neighbours of each vertex
+        // are queued by increasing degree
+        while (head < tail) {
+            int vertex = order[head++];
+            int number_of_keys = 0;
+
+            for (k = graph->offsets[vertex]; k < graph->offsets[vertex + 1]; k++) {
+                int next = graph->adjacent[k];
+                if (! visited[next]) {
+                    visited[next] = true;
+                    keys[number_of_keys++] = degree_key(graph, next);
+                }
+            }
+
+            qsort(keys, number_of_keys, sizeof(uint64_t), compare_keys);
+            for (k = 0; k < number_of_keys; k++)
+                order[tail++] = (int) (uint32_t) keys[k];
+        }
+    }
+
+    for (i = 0; i < number_of_vertices / 2; i++) {
+        int swap = order[i];
+        order[i] = order[number_of_vertices - 1 - i];
+        order[number_of_vertices - 1 - i] = swap;
+    }
+
+    free(level);
+    free(queue);
+    free(visited);
+    free(keys);
+    free(by_degree);
+    return order;
+}
+
+bool renumber_reaction_network(ReactionNetwork *reaction_network) {
+    if (reaction_network->network_mapping || reaction_network->species_ids)
+        return false;
+
+    int number_of_species = reaction_network->number_of_species;
+    int number_of_reactions = reaction_network->number_of_reactions;
+    int i, m;
+
+    BipartiteGraph graph = build_graph(reaction_network);
+    int *order = reverse_cuthill_mckee(&graph);
+
+    // old id -> new id, and the inverse
+    int *new_species = calloc(number_of_species, sizeof(int));
+    int *species_ids = calloc(number_of_species, sizeof(int));
+    int *reaction_ids = calloc(number_of_reactions, sizeof(int));
+    int next_species = 0;
+    int next_reaction = 0;
+
+    for (i = 0; i < graph.number_of_vertices; i++) {
+        int vertex = order[i];
+        if (vertex < number_of_species) {
+            new_species[vertex] = next_species;
+            species_ids[next_species++] = vertex;
+        } else
+            reaction_ids[next_reaction++] = vertex - number_of_species;
+    }
+
+    uint8_t *number_of_reactants = calloc(number_of_reactions, sizeof(uint8_t));
+    uint8_t *number_of_products = calloc(number_of_reactions, sizeof(uint8_t));
+    int *reactants_values = calloc(2 * number_of_reactions, sizeof(int));
+    int *products_values = calloc(2 * number_of_reactions, sizeof(int));
+    double *rates = calloc(number_of_reactions, sizeof(double));
+    int *initial_state = calloc(number_of_species, sizeof(int));
+
+    for (i = 0; i < number_of_reactions; i++) {
+        int old = reaction_ids[i];
+        number_of_reactants[i] = reaction_network->number_of_reactants[old];
+        number_of_products[i] = reaction_network->number_of_products[old];
+        rates[i] = reaction_network->rates[old];
+
+        // unused slots are copied as they are
+        for (m = 0; m < 2; m++) {
+            int reactant = reaction_network->reactants[old][m];
+            int product = reaction_network->products[old][m];
+            reactants_values[2 * i + m] = m < number_of_reactants[i] ?
+                new_species[reactant] : reactant;
+            products_values[2 * i + m] = m < number_of_products[i] ?
+                new_species[product] : product;
+        }
+    }
+
+    for (i = 0; i < number_of_species; i++)
+        initial_state[new_species[i]] = reaction_network->initial_state[i];
+
+    // merged reactions move with the reaction they were merged into
+    int *merged_offsets = NULL;
+    int *merged_reactions = NULL;
+    double *merged_shares = NULL;
+
+    if (reaction_network->merged_offsets) {
+        int number_of_merged = reaction_network->merged_offsets[number_of_reactions];
+        int next_merged = 0;
+        merged_offsets = calloc(number_of_reactions + 1, sizeof(int));
+        merged_reactions = calloc(number_of_merged, sizeof(int));
+        merged_shares = calloc(number_of_merged, sizeof(double));
+
+        for (i = 0; i < number_of_reactions; i++) {
+            int old = reaction_ids[i];
+            merged_offsets[i] = next_merged;
+            for (m = reaction_network->merged_offsets[old];
+                 m < reaction_network->merged_offsets[old + 1];
+                 m++) {
+                merged_reactions[next_merged] = reaction_network->merged_reactions[m];
+                merged_shares[next_merged] = reaction_network->merged_shares[m];
+                next_merged++;
+            }
+        }
+        merged_offsets[number_of_reactions] = next_merged;
+    }
+
+    // a reduced network already maps its reactions to the database
+    if (reaction_network->reaction_ids)
+        for (i = 0; i < number_of_reactions; i++)
+            reaction_ids[i] = reaction_network->reaction_ids[reaction_ids[i]];
+
+    free(reaction_network->number_of_reactants);
+    free(reaction_network->number_of_products);
+    free(reaction_network->reactants[0]);
+    free(reaction_network->products[0]);
+    free(reaction_network->rates);
+    free(reaction_network->initial_state);
+    free(reaction_network->packed_reactions);
+    free(reaction_network->species_reactions_offsets);
+    free(reaction_network->species_reactions);
+    free(reaction_network->initial_propensities);
+    free(reaction_network->reaction_ids);
+    free(reaction_network->merged_offsets);
+    free(reaction_network->merged_reactions);
+    free(reaction_network->merged_shares);
+
+    reaction_network->number_of_reactants = number_of_reactants;
+    reaction_network->number_of_products = number_of_products;
+    reaction_network->rates = rates;
+    reaction_network->initial_state = initial_state;
+    for (i = 0; i < number_of_reactions; i++) {
+        reaction_network->reactants[i] = reactants_values + 2 * i;
+        reaction_network->products[i] = products_values + 2 * i;
+    }
+
+    reaction_network->reaction_ids = reaction_ids;
+    reaction_network->species_ids = species_ids;
+    reaction_network->merged_offsets = merged_offsets;
+    reaction_network->merged_reactions = merged_reactions;
+    reaction_network->merged_shares = merged_shares;
+
+    // the dependency graph is still empty, so only the arrays
+    // derived from the reactions need rebuilding
+    initialize_packed_reactions(reaction_network);
+    initialize_species_reactions(reaction_network);
+    initialize_propensities(reaction_network);
+
+    free(new_species);
+    free(order);
+    free(graph.offsets);
+    free(graph.adjacent);
+    return true;
+}
+
+double species_reactions_cache_lines(ReactionNetwork *reaction_network) {
+    int *offsets = reaction_network->species_reactions_offsets;
+    int *reactions = reaction_network->species_reactions;
+    int reactions_per_line = 64 / sizeof(double);
+    double total = 0.0;
+    int counted = 0;
+
+    // each list is sorted, so a line is counted when it changes
+    for (int s = 0; s < reaction_network->number_of_species; s++) {
+        int last_line = -1;
+        for (int k = offsets[s]; k < offsets[s + 1]; k++) {
+            int line = reactions[k] / reactions_per_line;
+            if (line != last_line) {
+                total += 1.0;
+                last_line = line;
+            }
+        }
+
+        if (offsets[s + 1] > offsets[s])
+            counted++;
+    }
+
+    return counted ? total / counted : 0.0;
+}
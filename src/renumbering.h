@@ -0,0 +1,36 @@
+#ifndef RENUMBERING_H
+#define RENUMBERING_H
+
+#include "reaction_network.h"
+
+/***************************************************************************/
+/* renumbering                                                             */
+/* reaction and species ids come in whatever order the database lists      */
+/* them, so the reactions whose propensities change when a reaction fires  */
+/* are scattered over the solver's propensities, packed_reactions and the  */
+/* state, and each update of a step touches a different cache line.        */
+/*                                                                         */
+/* renumber_reaction_network orders the bipartite graph of species and     */
+/* reactions (a reaction is adjacent to its reactants and products) by     */
+/* reverse Cuthill-McKee, which keeps adjacent vertices close together,    */
+/* and numbers species and reactions in that order. Reactions sharing a    */
+/* species end up with nearby ids, and so do the species of a reaction.    */
+/*                                                                         */
+/* every array of the network is permuted, so simulations only ever see    */
+/* internal ids. reaction_ids maps them back to the database ids, which    */
+/* are the ones written to the trajectories.                               */
+/***************************************************************************/
+
+// call right after loading, before any dependency node is computed and
+// before loading a dependency cache. Networks which are memory mapped
+// from a compiled network can't be renumbered, they are renumbered when
+// compiling. Returns false if the network wasn't renumbered
+bool renumber_reaction_network(ReactionNetwork *reaction_network);
+
+// mean over species of the number of cache lines of propensities (8
+// doubles) holding the reactions consuming it. Those are the propensities
+// updated when a firing changes the species, so this counts the lines an
+// update touches, per species it changes
+double species_reactions_cache_lines(ReactionNetwork *reaction_network);
+
+#endif
@@ -1,26 +1,137 @@
 #include "sampler.h"
 
-Sampler *new_sampler(unsigned long int seed) {
+char *sampler_type_names[NUMBER_OF_SAMPLER_TYPES] = {
+  "gsl",
+  "philox",
+};
 
-    Sampler *p = calloc(1, sizeof(Sampler));
+int sampler_type_from_name(char *name) {
+  for (int i = 0; i < NUMBER_OF_SAMPLER_TYPES; i++)
+    if (strcmp(name, sampler_type_names[i]) == 0)
+      return i;
 
+  return -1;
+}
 
-    p->internal_rng_state = gsl_rng_alloc(gsl_rng_default);
-    p->seed = seed;
+Sampler *new_sampler(SamplerType type, unsigned long int seed) {
 
-    gsl_rng_set(p->internal_rng_state, seed);
+    // aligned for the philox buffers. sizeof(Sampler) is a multiple
+    // of the alignment, as aligned_alloc requires
+    Sampler *p = aligned_alloc(64, sizeof(Sampler));
+    memset(p, 0, sizeof(Sampler));
 
-    p->generate = &generate_method;
+    p->type = type;
+    if (type == gsl_sampler)
+        p->internal_rng_state = gsl_rng_alloc(gsl_rng_default);
+
+    reseed_sampler(p, seed);
 
     return p;
 }
 
 void free_sampler(Sampler *p) {
-    gsl_rng_free(p->internal_rng_state);
+    if (p->internal_rng_state)
+        gsl_rng_free(p->internal_rng_state);
     free(p);
 }
 
-double generate_method(void *samplerp) {
-    Sampler *p = (Sampler *) samplerp;
-    return gsl_rng_uniform_pos(p->internal_rng_state);
+void reseed_sampler(Sampler *p, unsigned long int seed) {
+    if (p->type == philox_sampler) {
+        // the first draw from each buffer refills it
+        p->key[0] = (uint32_t) seed;
+        p->key[1] = (uint32_t) ((uint64_t) seed >> 32);
+        p->uniform_block = 0;
+        p->exponential_block = 0;
+        p->uniform_position = SAMPLER_BUFFER_SIZE;
+        p->exponential_position = SAMPLER_BUFFER_SIZE;
+    }
+    else
+        gsl_rng_set(p->internal_rng_state, seed);
+
+    p->seed = seed;
+}
+
+static void fill_philox_buffer(Sampler *p,
+                               double *buffer,
+                               uint64_t first_block,
+                               uint32_t stream) {
+
+    for (int i = 0; i < SAMPLER_BUFFER_SIZE / 2; i++) {
+        uint64_t block = first_block + i;
+        uint32_t counter[4] = {
+            (uint32_t) block,
+            (uint32_t) (block >> 32),
+            stream,
+            0};
+
+        philox(counter, p->key[0], p->key[1]);
+        buffer[2 * i] = philox_to_double(counter[0], counter[1]);
+        buffer[2 * i + 1] = philox_to_double(counter[2], counter[3]);
+    }
+}
+
+void refill_uniform_buffer(Sampler *p) {
+    fill_philox_buffer(p, p->uniform_buffer, p->uniform_block,
+                       SAMPLER_UNIFORM_STREAM);
+    p->uniform_block += SAMPLER_BUFFER_SIZE / 2;
+    p->uniform_position = 0;
+}
+
+void refill_exponential_buffer(Sampler *p) {
+    fill_philox_buffer(p, p->exponential_buffer, p->exponential_block,
+                       SAMPLER_EXPONENTIAL_STREAM);
+    p->exponential_block += SAMPLER_BUFFER_SIZE / 2;
+    p->exponential_position = 0;
+
+    // separate loop so it vectorizes when the math library has a
+    // vector log (glibc with -O3 -ffast-math)
+    for (int i = 0; i < SAMPLER_BUFFER_SIZE; i++)
+        p->exponential_buffer[i] = - log(p->exponential_buffer[i]);
+}
+
+// the PTRS transformed rejection sampler of Hörmann,
+// Insurance Math. Econom. 12 (1993), for means of at least 10
+static unsigned int sample_poisson_ptrs(Sampler *p, double mean) {
+    double sqrt_mean = sqrt(mean);
+    double log_mean = log(mean);
+    double b = 0.931 + 2.53 * sqrt_mean;
+    double a = -0.059 + 0.02483 * b;
+    double inverse_alpha = 1.1239 + 1.1328 / (b - 3.4);
+    double v_r = 0.9277 - 3.6224 / (b - 2.0);
+
+    while (true) {
+        double u = sample_uniform(p) - 0.5;
+        double v = sample_uniform(p);
+        double u_s = 0.5 - fabs(u);
+        double k = floor((2.0 * a / u_s + b) * u + mean + 0.43);
+
+        if (u_s >= 0.07 && v <= v_r)
+            return (unsigned int) k;
+
+        if (k < 0.0 || (u_s < 0.013 && v > u_s))
+            continue;
+
+        if (log(v) + log(inverse_alpha) - log(a / (u_s * u_s) + b)
+            <= - mean + k * log_mean - lgamma(k + 1.0))
+            return (unsigned int) k;
+    }
+}
+
+unsigned int sample_poisson(Sampler *p, double mean) {
+    if (p->type == gsl_sampler)
+        return gsl_ran_poisson(p->internal_rng_state, mean);
+
+    if (mean >= 10.0)
+        return sample_poisson_ptrs(p, mean);
+
+    // multiply uniforms until the product drops below exp(-mean)
+    double limit = exp(- mean);
+    double product = sample_uniform(p);
+    unsigned int k = 0;
+    while (product > limit) {
+        k++;
+        product *= sample_uniform(p);
+    }
+
+    return k;
 }
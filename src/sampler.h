@@ -1,18 +1,132 @@
 #ifndef SAMPLER_H
 #define SAMPLER_H
 #include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
 
+/***************************************************************************/
+/* random numbers for the solvers                                          */
+/* there are two backends:                                                 */
+/* - gsl: gsl_rng_default. Reproduces trajectories of earlier versions.    */
+/* - philox: the counter based Philox4x32-10 generator of Salmon et al.,   */
+/*   SC '11. The nth block of random bits is philox(key = seed,            */
+/*   counter = n), so every seed is its own stream and a buffer of         */
+/*   uniforms is filled in one loop with no dependency between iterations, */
+/*   which the compiler can vectorize. Exponential samples -log(u), used   */
+/*   for time steps, are buffered the same way so the log is batched too.  */
+/***************************************************************************/
+
+typedef enum samplerType {
+  gsl_sampler,
+  philox_sampler,
+} SamplerType;
+
+#define NUMBER_OF_SAMPLER_TYPES 2
+
+extern char *sampler_type_names[NUMBER_OF_SAMPLER_TYPES];
+
+// returns -1 if name isn't a sampler type
+int sampler_type_from_name(char *name);
+
+// number of doubles generated per refill of each philox buffer.
+// must be even, every philox block gives two doubles
+#define SAMPLER_BUFFER_SIZE 256
+
+// philox counters are (low and high word of block, stream, 0)
+#define SAMPLER_UNIFORM_STREAM 0
+#define SAMPLER_EXPONENTIAL_STREAM 1
 
 typedef struct sampler {
-  gsl_rng *internal_rng_state;
+  SamplerType type;
   unsigned long int seed;
-  double (*generate)(void *samplerp);
+  gsl_rng *internal_rng_state; // NULL for philox
+
+  // philox state
+  uint32_t key[2];
+  uint64_t uniform_block;
+  uint64_t exponential_block;
+  int uniform_position;
+  int exponential_position;
+  double uniform_buffer[SAMPLER_BUFFER_SIZE] __attribute__((aligned(64)));
+  double exponential_buffer[SAMPLER_BUFFER_SIZE] __attribute__((aligned(64)));
 } Sampler;
 
 
-Sampler *new_sampler(unsigned long int seed);
+Sampler *new_sampler(SamplerType type, unsigned long int seed);
 void free_sampler(Sampler *p);
-double generate_method(void *samplerp);
+
+// start over as new_sampler(p->type, seed) would, without allocating
+void reseed_sampler(Sampler *p, unsigned long int seed);
+
+// refill the philox buffers. Only called when they run out
+void refill_uniform_buffer(Sampler *p);
+void refill_exponential_buffer(Sampler *p);
+
+// number of events of a poisson process with the given mean
+unsigned int sample_poisson(Sampler *p, double mean);
+
+
+// philox
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+static inline __attribute__((always_inline)) void philox(
+  uint32_t counter[4],
+  uint32_t key0,
+  uint32_t key1) {
+
+  for (int round = 0; round < PHILOX_ROUNDS; round++) {
+    uint64_t product0 = (uint64_t) PHILOX_M0 * counter[0];
+    uint64_t product1 = (uint64_t) PHILOX_M1 * counter[2];
+    uint32_t c0 = (uint32_t) (product1 >> 32) ^ counter[1] ^ key0;
+    uint32_t c1 = (uint32_t) product1;
+    uint32_t c2 = (uint32_t) (product0 >> 32) ^ counter[3] ^ key1;
+    uint32_t c3 = (uint32_t) product0;
+    counter[0] = c0;
+    counter[1] = c1;
+    counter[2] = c2;
+    counter[3] = c3;
+    key0 += PHILOX_W0;
+    key1 += PHILOX_W1;
+  }
+}
+
+// uniform double in (0,1) from the top 53 bits of a 64 bit word
+static inline double philox_to_double(uint32_t high, uint32_t low) {
+  uint64_t bits = ((uint64_t) high << 32 | low) >> 11;
+  return ((double) bits + 0.5) * 0x1.0p-53;
+}
+
+
+// uniform double in (0,1)
+static inline double sample_uniform(Sampler *p) {
+  if (p->type == gsl_sampler)
+    return gsl_rng_uniform_pos(p->internal_rng_state);
+
+  if (p->uniform_position == SAMPLER_BUFFER_SIZE)
+    refill_uniform_buffer(p);
+
+  return p->uniform_buffer[p->uniform_position++];
+}
+
+// -log of a uniform double in (0,1), ie exponential with mean 1.
+// the gsl backend draws the same number as sample_uniform would
+static inline double sample_exponential(Sampler *p) {
+  if (p->type == gsl_sampler)
+    return - log(gsl_rng_uniform_pos(p->internal_rng_state));
+
+  if (p->exponential_position == SAMPLER_BUFFER_SIZE)
+    refill_exponential_buffer(p);
+
+  return p->exponential_buffer[p->exponential_position++];
+}
 
 #endif
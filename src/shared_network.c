@@ -0,0 +1,271 @@
+#include "shared_network.h"
+#include "dependency_cache.h"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static uint64_t align(uint64_t offset) {
+    return (offset + COMPILED_NETWORK_ALIGNMENT - 1)
+        / COMPILED_NETWORK_ALIGNMENT * COMPILED_NETWORK_ALIGNMENT;
+}
+
+// shm_open wants names starting with a slash
+static void object_name(char *name, char *buffer, size_t size) {
+    snprintf(buffer, size, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+int create_shared_network(char *name) {
+    char path[256];
+    object_name(name, path, sizeof(path));
+
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        if (errno != EEXIST)
+            printf("create_shared_network error: can't create %s: %s\n",
+                   path, strerror(errno));
+        return fd;
+    }
+
+    // so waiting processes can tell if we die while loading the network
+    int32_t pid = getpid();
+    if (ftruncate(fd, sizeof(SharedNetworkHeader)) != 0 ||
+        pwrite(fd, &pid, sizeof(pid),
+               offsetof(SharedNetworkHeader, publisher_pid)) != sizeof(pid))
+        printf("create_shared_network error: can't size %s: %s\n",
+               path, strerror(errno));
+
+    return fd;
+}
+
+bool publish_shared_network(int fd,
+                            char *name,
+                            ReactionNetwork *reaction_network,
+                            uint64_t fingerprint,
+                            uint64_t arena_size) {
+    char path[256];
+    object_name(name, path, sizeof(path));
+
+    CompiledNetworkHeader image_header;
+    SharedNetworkHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SHARED_NETWORK_MAGIC, 8);
+    header.number_of_reactions = reaction_network->number_of_reactions;
+    header.image_offset = align(sizeof(SharedNetworkHeader));
+    header.image_size = layout_compiled_network(reaction_network, &image_header);
+    header.node_offsets_offset = align(header.image_offset + header.image_size);
+    uint64_t arena_start = align(
+        header.node_offsets_offset +
+        reaction_network->number_of_reactions * sizeof(uint64_t));
+    header.arena_end = arena_start + arena_size;
+    header.size = header.arena_end;
+
+    // the object is zero filled past the pid, so it reads as being
+    // published, and every node offset as not computed, until the header
+    // is written
+    char *mapping = MAP_FAILED;
+    if (ftruncate(fd, header.size) == 0)
+        mapping = mmap(NULL, header.size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        printf("publish_shared_network error: can't size %s: %s\n",
+               path, strerror(errno));
+        // waiting processes notice the object is gone
+        shm_unlink(path);
+        return false;
+    }
+
+    write_compiled_network(reaction_network, &image_header,
+                           mapping + header.image_offset);
+
+    SharedNetworkHeader *shared_header = (SharedNetworkHeader *) mapping;
+    memcpy(shared_header->magic, header.magic, 8);
+    shared_header->number_of_reactions = header.number_of_reactions;
+    shared_header->fingerprint = fingerprint;
+    shared_header->size = header.size;
+    shared_header->image_offset = header.image_offset;
+    shared_header->image_size = header.image_size;
+    shared_header->node_offsets_offset = header.node_offsets_offset;
+    shared_header->arena_end = header.arena_end;
+    atomic_store_explicit(&shared_header->arena_used, arena_start,
+                          memory_order_relaxed);
+
+    atomic_store_explicit(&shared_header->state, shared_network_ready,
+                          memory_order_release);
+
+    munmap(mapping, header.size);
+    return true;
+}
+
+void abandon_shared_network(int fd, char *name) {
+    char path[256];
+    object_name(name, path, sizeof(path));
+    close(fd);
+    shm_unlink(path);
+}
+
+uint64_t shared_network_fingerprint(char *path, sqlite3 *reaction_database) {
+    if (reaction_database)
+        return reaction_database_fingerprint(reaction_database);
+
+    // mapping a compiled network is cheap, and it is in the page cache
+    // for the publisher anyway
+    ReactionNetwork *reaction_network = new_reaction_network_from_compiled(
+        path, 0);
+    if (! reaction_network)
+        return 0;
+
+    uint64_t fingerprint = network_fingerprint_with_rates(reaction_network);
+    free_reaction_network(reaction_network);
+    return fingerprint;
+}
+
+// true if the publisher which created the object behind header has died
+// before publishing it
+static bool publisher_died(SharedNetworkHeader *header, time_t waiting_since) {
+    pid_t pid = header ? header->publisher_pid : 0;
+
+    if (pid > 0)
+        return kill(pid, 0) != 0 && errno == ESRCH;
+
+    // the publisher hasn't got to writing its pid
+    return time(NULL) - waiting_since > SHARED_NETWORK_CREATE_TIMEOUT;
+}
+
+ReactionNetwork *attach_shared_network(char *name,
+                                       uint64_t fingerprint,
+                                       sqlite3 *initial_state_database,
+                                       int dependency_threshold) {
+    char path[256];
+    object_name(name, path, sizeof(path));
+
+    int fd = shm_open(path, O_RDWR, 0);
+    if (fd < 0) {
+        printf("attach_shared_network error: can't open %s: %s\n",
+               path, strerror(errno));
+        return NULL;
+    }
+
+    struct timespec poll_interval = {0, 10000000}; // 10ms
+    struct stat object_stat;
+    time_t waiting_since = time(NULL);
+    bool waiting = false;
+    SharedNetworkHeader *header = MAP_FAILED;
+    char *mapping = MAP_FAILED;
+    size_t size = 0;
+    uint32_t state = shared_network_publishing;
+
+    // the publisher sizes the object for the header, then for the whole
+    // network once it is loaded, then fills it in
+    while (state == shared_network_publishing) {
+        if (fstat(fd, &object_stat) != 0 || object_stat.st_nlink == 0) {
+            state = shared_network_failed;
+            break;
+        }
+
+        if (header == MAP_FAILED &&
+            (size_t) object_stat.st_size >= sizeof(SharedNetworkHeader))
+            header = mmap(NULL, sizeof(SharedNetworkHeader),
+                          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (header != MAP_FAILED)
+            state = atomic_load_explicit(&header->state, memory_order_acquire);
+
+        if (state == shared_network_publishing &&
+            publisher_died(header == MAP_FAILED ? NULL : header,
+                           waiting_since)) {
+            printf("attach_shared_network error: the process publishing %s "
+                   "died, remove /dev/shm%s and run again\n", path, path);
+            if (header != MAP_FAILED)
+                munmap(header, sizeof(SharedNetworkHeader));
+            close(fd);
+            return NULL;
+        }
+
+        if (state == shared_network_publishing) {
+            if (! waiting)
+                printf("attach_shared_network: waiting for %s "
+                       "to be published\n", path);
+            waiting = true;
+            nanosleep(&poll_interval, NULL);
+        }
+    }
+
+    if (state == shared_network_ready &&
+        fstat(fd, &object_stat) == 0 &&
+        (size_t) object_stat.st_size == header->size) {
+        size = header->size;
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+    }
+
+    if (header != MAP_FAILED)
+        munmap(header, sizeof(SharedNetworkHeader));
+    close(fd);
+
+    header = (SharedNetworkHeader *) mapping;
+    bool ok = mapping != MAP_FAILED &&
+        memcmp(header->magic, SHARED_NETWORK_MAGIC, 8) == 0 &&
+        header->size == size &&
+        header->image_offset + header->image_size <= header->node_offsets_offset &&
+        header->node_offsets_offset +
+        header->number_of_reactions * sizeof(uint64_t) <= header->arena_end &&
+        header->arena_end <= size;
+
+    if (ok && header->fingerprint != fingerprint) {
+        printf("attach_shared_network error: %s was published from another "
+               "reaction network, remove /dev/shm%s and run again\n",
+               path, path);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    ReactionNetwork *reaction_network = NULL;
+    if (ok)
+        reaction_network = reaction_network_from_image(
+            mapping + header->image_offset,
+            header->image_size,
+            dependency_threshold,
+            false);
+
+    if (! reaction_network) {
+        printf("attach_shared_network error: "
+               "%s is not a usable shared network\n", path);
+        if (mapping != MAP_FAILED)
+            munmap(mapping, size);
+        return NULL;
+    }
+
+    // from here, freeing the network unmaps the object
+    reaction_network->network_mapping = mapping;
+    reaction_network->network_mapping_size = size;
+
+    if ((uint32_t) reaction_network->number_of_reactions !=
+        header->number_of_reactions) {
+        printf("attach_shared_network error: "
+               "%s is not a usable shared network\n", path);
+        free_reaction_network(reaction_network);
+        return NULL;
+    }
+
+    reaction_network->shared_node_offsets =
+        (_Atomic uint64_t *) (mapping + header->node_offsets_offset);
+    reaction_network->shared_arena_used = &header->arena_used;
+    reaction_network->shared_arena_end = header->arena_end;
+
+    // the image holds the factors and initial state of the publisher
+    if (! read_image_initial_state(reaction_network,
+                                   initial_state_database, path)) {
+        free_reaction_network(reaction_network);
+        return NULL;
+    }
+
+    return reaction_network;
+}
@@ -0,0 +1,114 @@
+#ifndef SHARED_NETWORK_H
+#define SHARED_NETWORK_H
+
+#include "reaction_network.h"
+#include "compiled_network.h"
+
+/***************************************************************************/
+/* shared networks                                                         */
+/* several RNMC processes on a node, each with its own initial state       */
+/* database, can share one copy of the reaction network. The first process */
+/* to open the POSIX shared memory object named by --shared_network        */
+/* publishes the network in it, and every process (the first one too)      */
+/* then attaches to it. The network is resident once per node instead of   */
+/* once per process.                                                       */
+/*                                                                         */
+/* dependency nodes are shared as well: a process which computes a node    */
+/* copies it to an arena in the object and publishes its offset, and the   */
+/* other processes use it instead of computing it again. Shared nodes      */
+/* don't count against the dependency memory budget and aren't evicted.   */
+/* Once the arena is full, new nodes are private to the process.           */
+/*                                                                         */
+/* each process reads the factors and the initial state from its own       */
+/* initial state database, so they may differ between processes. A         */
+/* network reduced by the publisher (see reduction.h) only has the         */
+/* reactions which can fire from the publisher's initial state, so a       */
+/* process whose initial state has a species the publisher's didn't (or    */
+/* two where it had fewer) refuses to attach.                              */
+/*                                                                         */
+/* the object outlives the processes, so later runs attach to it too. It   */
+/* holds a fingerprint of the network it was published from, and a        */
+/* process given a different reaction database refuses to attach. The pid  */
+/* of the publisher is written as soon as the object is created, so        */
+/* waiting processes notice when it died before publishing. In both cases  */
+/* remove the object (rm /dev/shm/<name>) and run again.                   */
+/*                                                                         */
+/* layout:                                                                 */
+/* - SharedNetworkHeader                                                   */
+/* - the network as a compiled network image, see compiled_network.h       */
+/* - uint64_t node_offsets[number_of_reactions]                            */
+/* - the node arena                                                        */
+/* each part aligned to COMPILED_NETWORK_ALIGNMENT.                        */
+/***************************************************************************/
+
+#define SHARED_NETWORK_MAGIC "RNMCSHM2"
+
+// pages of the arena are only allocated once nodes are written to them,
+// so reserving plenty costs nothing up front
+#define SHARED_NETWORK_DEFAULT_ARENA_SIZE (1ull << 30)
+
+// a new object is sized and gets the pid of its publisher right after it
+// is created. One which still hasn't after this long was left behind by a
+// publisher which died in between
+#define SHARED_NETWORK_CREATE_TIMEOUT 10 // seconds
+
+typedef enum sharedNetworkState {
+    shared_network_publishing,
+    shared_network_ready,
+    shared_network_failed,
+} SharedNetworkState;
+
+typedef struct sharedNetworkHeader {
+    char magic[8];
+    _Atomic uint32_t state; // a SharedNetworkState
+    uint32_t number_of_reactions;
+    int32_t publisher_pid; // written by create_shared_network
+    uint32_t unused;
+    // network_fingerprint_with_rates of the network as loaded from the
+    // reaction database, before reduction or renumbering
+    uint64_t fingerprint;
+    uint64_t size;
+    uint64_t image_offset;
+    uint64_t image_size;
+    uint64_t node_offsets_offset;
+    // offsets from the start of the object
+    _Atomic uint64_t arena_used;
+    uint64_t arena_end;
+} SharedNetworkHeader;
+
+// returns a descriptor of a new shared memory object called name if this
+// process gets to publish the network, or -1 if it already exists, in
+// which case attach to it
+int create_shared_network(char *name);
+
+// publishes reaction_network in the object created by
+// create_shared_network, with an arena of arena_size bytes for dependency
+// nodes. fingerprint is network_fingerprint_with_rates of the network
+// before it was reduced or renumbered. Closes fd. On failure the object is
+// removed, and processes waiting to attach to it give up
+bool publish_shared_network(int fd,
+                            char *name,
+                            ReactionNetwork *reaction_network,
+                            uint64_t fingerprint,
+                            uint64_t arena_size);
+
+// removes the object created by create_shared_network when the network
+// to publish couldn't be loaded, so waiting processes give up
+void abandon_shared_network(int fd, char *name);
+
+// the fingerprint publish_shared_network is given for reaction_database,
+// without loading the whole network. reaction_database is NULL for a
+// compiled network, which is read from path
+uint64_t shared_network_fingerprint(char *path, sqlite3 *reaction_database);
+
+// maps the shared network called name, waiting for it to be published,
+// and reads the initial state from initial_state_database.
+// returns NULL if there is no usable shared network called name, if it
+// was published from a network with another fingerprint, or if it was
+// reduced for an initial state this one needs more reactions than
+ReactionNetwork *attach_shared_network(char *name,
+                                       uint64_t fingerprint,
+                                       sqlite3 *initial_state_database,
+                                       int dependency_threshold);
+
+#endif
@@ -1,22 +1,58 @@
 #include "simulation.h"
+#include <string.h>
 
-Chunk *new_chunk() {
-    Chunk *chunkp = calloc(1, sizeof(Chunk));
-    int i;
-    for (i = 0; i < CHUNK_SIZE; i++) {
-        chunkp->data[i].reaction = -1;
-        chunkp->data[i].time = 0.0;
+ChunkPool *new_chunk_pool() {
+    ChunkPool *chunk_pool = calloc(1, sizeof(ChunkPool));
+    pthread_mutex_init(&chunk_pool->mutex, NULL);
+    chunk_pool->free_chunks = NULL;
+    return chunk_pool;
+}
+
+void free_chunk_pool(ChunkPool *chunk_pool) {
+    Chunk *chunk = chunk_pool->free_chunks;
+    Chunk *next_chunk;
+
+    while (chunk) {
+        next_chunk = chunk->next_chunk;
+        free(chunk);
+        chunk = next_chunk;
     }
-    chunkp->next_free_index = 0;
-    chunkp->next_chunk = NULL;
-    return chunkp;
+
+    pthread_mutex_destroy(&chunk_pool->mutex);
+    free(chunk_pool);
 }
 
-SimulationHistory *new_simulation_history() {
+// the data isn't initialized, only the bytes written are ever read
+static Chunk *new_chunk(ChunkPool *chunk_pool) {
+    Chunk *chunk = NULL;
+
+    if (chunk_pool) {
+        pthread_mutex_lock(&chunk_pool->mutex);
+        chunk = chunk_pool->free_chunks;
+        if (chunk)
+            chunk_pool->free_chunks = chunk->next_chunk;
+        pthread_mutex_unlock(&chunk_pool->mutex);
+    }
+
+    if (! chunk)
+        chunk = malloc(sizeof(Chunk));
+
+    chunk->next_free_index = 0;
+    chunk->next_chunk = NULL;
+    return chunk;
+}
+
+SimulationHistory *new_simulation_history(ChunkPool *chunk_pool,
+                                          bool float_times) {
     SimulationHistory *simulation_history = calloc(1, sizeof(SimulationHistory));
-    Chunk *chunk = new_chunk();
+    Chunk *chunk = new_chunk(chunk_pool);
     simulation_history->first_chunk = chunk;
     simulation_history->last_chunk = chunk;
+    simulation_history->chunk_pool = chunk_pool;
+    simulation_history->float_times = float_times;
+    simulation_history->length = 0;
+    simulation_history->last_reaction = 0;
+    simulation_history->last_time = 0.0;
 
     return simulation_history;
 }
@@ -24,50 +60,143 @@ SimulationHistory *new_simulation_history() {
 void free_simulation_history(SimulationHistory *simulation_history) {
   Chunk *chunk = simulation_history->first_chunk;
   Chunk *next_chunk;
-
-  while (chunk) {
-    next_chunk = chunk->next_chunk;
-    free(chunk);
-    chunk = next_chunk;
+  ChunkPool *chunk_pool = simulation_history->chunk_pool;
+
+  if (chunk_pool) {
+    // the chunks are already linked, so they go back in one go
+    pthread_mutex_lock(&chunk_pool->mutex);
+    simulation_history->last_chunk->next_chunk = chunk_pool->free_chunks;
+    chunk_pool->free_chunks = chunk;
+    pthread_mutex_unlock(&chunk_pool->mutex);
   }
+  else
+    while (chunk) {
+      next_chunk = chunk->next_chunk;
+      free(chunk);
+      chunk = next_chunk;
+    }
 
   free(simulation_history);
 }
 
+static inline uint8_t *put_varint(uint8_t *data, uint64_t value) {
+    while (value >= 0x80) {
+        *data++ = (uint8_t) value | 0x80;
+        value >>= 7;
+    }
+    *data++ = (uint8_t) value;
+    return data;
+}
+
+static inline uint8_t *get_varint(uint8_t *data, uint64_t *value) {
+    int shift = 0;
+    *value = 0;
+    while (*data & 0x80) {
+        *value |= (uint64_t) (*data++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *value |= (uint64_t) *data++ << shift;
+    return data;
+}
+
 void insert_history_element(
     SimulationHistory *simulation_history,
     int reaction,
+    int count,
     double time) {
 
     Chunk *last_chunk = simulation_history->last_chunk;
-    if (last_chunk->next_free_index == CHUNK_SIZE) {
-        Chunk *next_chunk = new_chunk();
+    if (last_chunk->next_free_index > CHUNK_SIZE - MAX_ENCODED_ROW_SIZE) {
+        Chunk *next_chunk = new_chunk(simulation_history->chunk_pool);
         last_chunk->next_chunk = next_chunk;
         simulation_history->last_chunk = next_chunk;
-        next_chunk->data[0].reaction = reaction;
-        next_chunk->data[0].time = time;
-        next_chunk->next_free_index++;
+        last_chunk = next_chunk;
+    }
+
+    uint8_t *data = last_chunk->data + last_chunk->next_free_index;
+
+    // zigzag, so small negative differences are small too
+    int64_t difference = (int64_t) reaction - simulation_history->last_reaction;
+    uint64_t zigzag = ((uint64_t) difference << 1) ^ (uint64_t) (difference >> 63);
+    data = put_varint(data, (zigzag << 1) | (count != 1));
+    if (count != 1)
+        data = put_varint(data, (uint32_t) count);
+
+    if (simulation_history->float_times) {
+        float time_difference = (float) (time - simulation_history->last_time);
+        memcpy(data, &time_difference, sizeof(float));
+        data += sizeof(float);
+        // what next_history_element will decode
+        simulation_history->last_time += (double) time_difference;
     } else {
-        last_chunk->data[last_chunk->next_free_index].reaction = reaction;
-        last_chunk->data[last_chunk->next_free_index].time = time;
-        last_chunk->next_free_index++;
-  }
+        memcpy(data, &time, sizeof(double));
+        data += sizeof(double);
+        simulation_history->last_time = time;
+    }
+
+    simulation_history->last_reaction = reaction;
+    simulation_history->length++;
+    last_chunk->next_free_index = data - last_chunk->data;
 }
 
 int simulation_history_length(SimulationHistory *simulation_history) {
-  int length = 0;
-  Chunk *chunk = simulation_history->first_chunk;
-  while (chunk) {
-    length += chunk->next_free_index;
-    chunk = chunk->next_chunk;
-  }
-  return length;
+  return simulation_history->length;
+}
+
+void start_history_cursor(HistoryCursor *cursor,
+                          SimulationHistory *simulation_history) {
+  cursor->chunk = simulation_history->first_chunk;
+  cursor->index = 0;
+  cursor->float_times = simulation_history->float_times;
+  cursor->last_reaction = 0;
+  cursor->last_time = 0.0;
+}
+
+bool next_history_element(HistoryCursor *cursor, HistoryElement *element) {
+    while (cursor->chunk && cursor->index == cursor->chunk->next_free_index) {
+        cursor->chunk = cursor->chunk->next_chunk;
+        cursor->index = 0;
+    }
+
+    if (! cursor->chunk)
+        return false;
+
+    uint8_t *data = cursor->chunk->data + cursor->index;
+    uint64_t value;
+
+    data = get_varint(data, &value);
+    bool has_count = value & 1;
+    uint64_t zigzag = value >> 1;
+    int64_t difference = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+    cursor->last_reaction = (int) (cursor->last_reaction + difference);
+
+    element->count = 1;
+    if (has_count) {
+        data = get_varint(data, &value);
+        element->count = (int) value;
+    }
+
+    if (cursor->float_times) {
+        float time_difference;
+        memcpy(&time_difference, data, sizeof(float));
+        data += sizeof(float);
+        cursor->last_time += (double) time_difference;
+    } else {
+        memcpy(&cursor->last_time, data, sizeof(double));
+        data += sizeof(double);
+    }
+
+    element->reaction = cursor->last_reaction;
+    element->time = cursor->last_time;
+    cursor->index = data - cursor->chunk->data;
+    return true;
 }
 
 
 Simulation *new_simulation(ReactionNetwork *reaction_network,
                            unsigned long int seed,
-                           SolveType type) {
+                           SolveType type,
+                           SamplerType sampler_type) {
   int i;
 
 
@@ -82,11 +211,27 @@ Simulation *new_simulation(ReactionNetwork *reaction_network,
   simulation->time = 0.0;
   simulation->step = 0;
   simulation->solver = new_solve(type,
+                         sampler_type,
                          seed,
-                         reaction_network->number_of_reactions,
-                         reaction_network->initial_propensities);
-
-  simulation->history = new_simulation_history();
+                         reaction_network,
+                         simulation->state);
+
+  simulation->history = new_simulation_history(NULL, false);
+  simulation->chunk_pool = NULL;
+  simulation->float_times = false;
+  simulation->dependency_reader = -1;
+  simulation->propensity_buffer = calloc(
+      reaction_network->number_of_reactions, sizeof(double));
+
+  simulation->dirty_species = calloc(
+      reaction_network->number_of_species, sizeof(int));
+  simulation->species_is_dirty = calloc(
+      reaction_network->number_of_species, sizeof(bool));
+  simulation->dirty_reactions = calloc(
+      reaction_network->number_of_reactions / DIRTY_LOG_FRACTION + 1,
+      sizeof(int));
+  simulation->reaction_is_dirty = calloc(
+      reaction_network->number_of_reactions, sizeof(bool));
 
   return simulation;
 }
@@ -96,17 +241,120 @@ void free_simulation(Simulation *simulation) {
   // don't free the simulation history as it gets transfered to and
   // freed by the dispatcher
   free(simulation->state);
+  free(simulation->propensity_buffer);
+  free(simulation->dirty_species);
+  free(simulation->species_is_dirty);
+  free(simulation->dirty_reactions);
+  free(simulation->reaction_is_dirty);
   free_solve(simulation->solver);
   free(simulation);
 }
 
-bool step(Simulation *simulation) {
+void mark_simulation_dirty(Simulation *simulation) {
+  simulation->dirty_log_full = true;
+}
+
+static inline void log_dirty_species(Simulation *simulation, int species) {
+  if (! simulation->species_is_dirty[species]) {
+    simulation->species_is_dirty[species] = true;
+    simulation->dirty_species[simulation->number_of_dirty_species++] = species;
+  }
+}
+
+static inline void log_dirty_reactions(Simulation *simulation,
+                                       int number_of_reactions,
+                                       int *reactions) {
+  int limit =
+    simulation->reaction_network->number_of_reactions / DIRTY_LOG_FRACTION;
+
+  for (int i = 0; i < number_of_reactions && ! simulation->dirty_log_full; i++) {
+    int reaction = reactions[i];
+    if (simulation->reaction_is_dirty[reaction]) continue;
+
+    if (simulation->number_of_dirty_reactions == limit) {
+      simulation->dirty_log_full = true;
+      break;
+    }
+
+    simulation->reaction_is_dirty[reaction] = true;
+    simulation->dirty_reactions[simulation->number_of_dirty_reactions++] =
+      reaction;
+  }
+}
+
+void reset_simulation(Simulation *simulation,
+                      Solve *initial_solver,
+                      unsigned long int seed) {
+  ReactionNetwork *reaction_network = simulation->reaction_network;
+  int number_of_dirty = simulation->number_of_dirty_reactions;
+  int *dirty = simulation->dirty_reactions;
+  int i;
+
+  simulation->seed = seed;
+  simulation->time = 0.0;
+  simulation->step = 0;
+
+  // the log is in the order reactions were first updated, which is only
+  // sorted within each dependency node. update_many refreshes some
+  // ancestors twice because of that, which is still cheaper than sorting
+  bool reset = false;
+  if (! simulation->dirty_log_full) {
+    for (i = 0; i < number_of_dirty; i++)
+      simulation->propensity_buffer[i] =
+        reaction_network->initial_propensities[dirty[i]];
+
+    reset = reset_dirty_solve(simulation->solver, initial_solver, seed,
+                              number_of_dirty, dirty,
+                              simulation->propensity_buffer);
+  }
+
+  if (! reset)
+    reset_solve(simulation->solver, initial_solver, seed);
+
+  if (simulation->dirty_log_full)
+    memcpy(simulation->state, reaction_network->initial_state,
+           reaction_network->number_of_species * sizeof(int));
+  else
+    for (i = 0; i < simulation->number_of_dirty_species; i++)
+      simulation->state[simulation->dirty_species[i]] =
+        reaction_network->initial_state[simulation->dirty_species[i]];
+
+  // the log is cleared whether or not it was used
+  for (i = 0; i < simulation->number_of_dirty_species; i++)
+    simulation->species_is_dirty[simulation->dirty_species[i]] = false;
+  for (i = 0; i < number_of_dirty; i++)
+    simulation->reaction_is_dirty[dirty[i]] = false;
+  simulation->number_of_dirty_species = 0;
+  simulation->number_of_dirty_reactions = 0;
+  simulation->dirty_log_full = false;
+
+  // the previous history was handed to the dispatcher
+  simulation->history = new_simulation_history(simulation->chunk_pool,
+                                               simulation->float_times);
+}
+
+void set_history_format(Simulation *simulation,
+                        ChunkPool *chunk_pool,
+                        bool float_times) {
+  simulation->chunk_pool = chunk_pool;
+  simulation->float_times = float_times;
+  free_simulation_history(simulation->history);
+  simulation->history = new_simulation_history(chunk_pool, float_times);
+}
+
+// the body of step. It is always inlined, so when event and update_many
+// are compile time constants (see SPECIALIZED_STEP below) they become
+// direct calls, which the compiler can inline when building with -flto.
+static inline __attribute__((always_inline)) bool step_with_solver(
+    Simulation *simulation,
+    int (*event)(void *, double *),
+    void (*update_many)(void *, int, int *, double *),
+    void (*update_species)(void *, int, int *)) {
+
     int m;
     double dt;
     bool dead_end = false;
-    int next_reaction = simulation->solver->event(simulation->solver, &dt);
-    int reaction_index;
-    double new_propensity;
+    int next_reaction = event(simulation->solver, &dt);
 
     if (next_reaction < 0) dead_end = true;
     else {
@@ -118,72 +366,170 @@ bool step(Simulation *simulation) {
         insert_history_element(
             simulation->history,
             next_reaction,
+            1,
             simulation->time);
 
+        PackedReaction *fired =
+            simulation->reaction_network->packed_reactions + next_reaction;
+
         // update state
-        for (m = 0;
-             m < simulation->reaction_network->number_of_reactants[next_reaction];
-             m++)
+        for (m = 0; m < 2; m++) {
+            if (fired->reactants[m] >= 0) {
+                simulation->state[fired->reactants[m]]--;
+                log_dirty_species(simulation, fired->reactants[m]);
+            }
+
+            if (fired->products[m] >= 0) {
+                simulation->state[fired->products[m]]++;
+                log_dirty_species(simulation, fired->products[m]);
+            }
+        }
+
+        // the solver reads the state itself, so only tell it which
+        // species changed. Reactions have at most 2 reactants and 2 products
+        if (update_species) {
+            int changed_species[4];
+            int number_of_changed_species = 0;
 
-            simulation->state[
-                simulation->reaction_network->reactants[next_reaction][m]]--;
+            for (m = 0; m < 2; m++) {
+                if (fired->reactants[m] >= 0)
+                    changed_species[number_of_changed_species++] =
+                        fired->reactants[m];
 
-        for (m = 0;
-             m < simulation->reaction_network->number_of_products[next_reaction];
-             m++)
+                if (fired->products[m] >= 0)
+                    changed_species[number_of_changed_species++] =
+                        fired->products[m];
+            }
+
+            update_species(
+                simulation->solver,
+                number_of_changed_species,
+                changed_species);
 
-            simulation->state[
-                simulation->reaction_network->products[next_reaction][m]]++;
+            return dead_end;
+        }
 
         // update propensities
-        DependentsNode *dependents_node = get_dependency_node(
+        Dependents *dependents = get_dependency_node(
             simulation->reaction_network,
             next_reaction);
 
-
-        int *dependents = dependents_node->dependents;
+        int *reactions_to_update;
+        int number_of_updates;
 
         if (dependents) {
-            // relevent section of dependency graph has been computed
-            int number_of_updates = dependents_node->number_of_dependents;
-
-            for (m = 0; m < number_of_updates; m++) {
-
-                reaction_index = dependents[m];
-                new_propensity = compute_propensity(
-                    simulation->reaction_network,
-                    simulation->state,
-                    reaction_index);
-
-                simulation->solver->update(
-                    simulation->solver,
-                    reaction_index,
-                    new_propensity);
-            }
-        } else {
+            reactions_to_update = dependents->dependents;
+            number_of_updates = dependents->number_of_dependents;
+            log_dirty_reactions(simulation, number_of_updates, reactions_to_update);
+        }
+        else {
             // relevent section of dependency graph has not been computed
-            for (reaction_index = 0;
-                 reaction_index < simulation->reaction_network->number_of_reactions;
-                 reaction_index++) {
+            // so recompute every propensity
+            reactions_to_update = simulation->reaction_network->all_reactions;
+            number_of_updates = simulation->reaction_network->number_of_reactions;
+            mark_simulation_dirty(simulation);
+        }
+
+        // fill the propensity buffer and hand it to the solver in one go,
+        // so shared ancestors in the solver are only refreshed once
+        compute_propensities(
+            simulation->reaction_network,
+            simulation->state,
+            number_of_updates,
+            reactions_to_update,
+            simulation->propensity_buffer);
+
+        update_many(
+            simulation->solver,
+            number_of_updates,
+            reactions_to_update,
+            simulation->propensity_buffer);
+
+        if (simulation->dependency_reader >= 0)
+            dependency_quiescent(
+                simulation->reaction_network,
+                simulation->dependency_reader);
+    }
 
-                new_propensity = compute_propensity(
-                    simulation->reaction_network,
-                    simulation->state,
-                    reaction_index);
+  return dead_end;
+}
 
-                simulation->solver->update(
-                    simulation->solver,
-                    reaction_index,
-                    new_propensity);
 
-            }
-        }
+bool step(Simulation *simulation) {
+    return step_with_solver(
+        simulation,
+        simulation->solver->event,
+        simulation->solver->update_many,
+        simulation->solver->update_species);
+}
 
+#ifdef SPECIALIZED_STEP
+
+// one copy of the simulation loop per solver, calling the solver directly.
+// the Solve struct is only used to pick the loop.
+#define SPECIALIZED_RUN_FOR(suffix, update_species)                     \
+    static void run_for_##suffix(Simulation *simulation, int step_cutoff) { \
+        while (!step_with_solver(simulation,                            \
+                                 &event_solve_##suffix,                 \
+                                 &update_many_solve_##suffix,           \
+                                 update_species)) {                     \
+            if (simulation->step > step_cutoff)                         \
+                break;                                                  \
+        }                                                               \
     }
 
-  return dead_end;
+SPECIALIZED_RUN_FOR(linear, NULL)
+SPECIALIZED_RUN_FOR(tree, NULL)
+SPECIALIZED_RUN_FOR(composition, NULL)
+SPECIALIZED_RUN_FOR(wide_tree, NULL)
+SPECIALIZED_RUN_FOR(next_reaction, NULL)
+SPECIALIZED_RUN_FOR(integer_tree, NULL)
+SPECIALIZED_RUN_FOR(active_set, NULL)
+SPECIALIZED_RUN_FOR(sorting_linear, NULL)
+SPECIALIZED_RUN_FOR(partial_propensity,
+                    &update_species_solve_partial_propensity)
+
+void run_for(Simulation *simulation, int step_cutoff) {
+  switch (simulation->solver->type) {
+  case linear:
+    run_for_linear(simulation, step_cutoff);
+    break;
+
+  case tree:
+    run_for_tree(simulation, step_cutoff);
+    break;
+
+  case composition_rejection:
+    run_for_composition(simulation, step_cutoff);
+    break;
+
+  case wide_tree:
+    run_for_wide_tree(simulation, step_cutoff);
+    break;
+
+  case next_reaction:
+    run_for_next_reaction(simulation, step_cutoff);
+    break;
+
+  case integer_tree:
+    run_for_integer_tree(simulation, step_cutoff);
+    break;
+
+  case active_set:
+    run_for_active_set(simulation, step_cutoff);
+    break;
+
+  case sorting_linear:
+    run_for_sorting_linear(simulation, step_cutoff);
+    break;
+
+  case partial_propensity:
+    run_for_partial_propensity(simulation, step_cutoff);
+    break;
+  }
 }
 
+#else
 
 void run_for(Simulation *simulation, int step_cutoff) {
   while (!step(simulation)) {
@@ -192,6 +538,8 @@ void run_for(Simulation *simulation, int step_cutoff) {
   }
 }
 
+#endif
+
 bool check_state_positivity(Simulation *simulation) {
   int i;
   for (i = 0; i < simulation->reaction_network->number_of_species; i++) {
@@ -6,35 +6,97 @@
 #include "reaction_network.h"
 #include "solvers.h"
 
-#define CHUNK_SIZE 1024
+/***************************************************************************/
+/* simulation histories                                                    */
+/* histories wait in the dispatcher's queue until they are written, so     */
+/* with many threads and long trajectories they take most of the memory.   */
+/* Rows are encoded into byte chunks instead of being stored as            */
+/* HistoryElements:                                                        */
+/* - a varint of (zigzag(reaction - previous reaction) << 1) | (count != 1) */
+/*   reactions firing one after another are usually close, so this is one */
+/*   or two bytes                                                          */
+/* - a varint of count, if it isn't 1 (tau leaping)                        */
+/* - the time as a double, or with float_times, the difference from the    */
+/*   previous time as a float. The difference is taken from the time the   */
+/*   reader will decode, so rounding errors don't add up along the         */
+/*   trajectory: a decoded time is off by at most half a float ulp of one  */
+/*   step.                                                                 */
+/* a row never straddles two chunks.                                       */
+/*                                                                         */
+/* chunks come from the ChunkPool of the thread running the simulation,    */
+/* and go back to it when the dispatcher frees the history, so chunks are  */
+/* reused instead of going through malloc for every trajectory.            */
+/***************************************************************************/
 
+// a chunk, with its header, is 1 KiB
+#define CHUNK_SIZE 1008
 
+// two varints of up to 5 bytes and a double
+#define MAX_ENCODED_ROW_SIZE 18
+
+
+// a decoded row of a history
 typedef struct historyElement {
     int reaction;
+    // number of times the reaction fired. Always 1 for exact simulations,
+    // tau leaping records all the firings of a reaction in a leap at once.
+    int count;
     double time;
 } HistoryElement;
 
 typedef struct chunk {
-  HistoryElement data[CHUNK_SIZE];
-  int next_free_index;
   struct chunk *next_chunk;
+  int next_free_index; // bytes of data used
+  uint8_t data[CHUNK_SIZE];
 } Chunk;
 
-// Chunks are never freed by themselves.
-// always freed as part of a simulation history
-Chunk *new_chunk();
+// free chunks, shared by a simulation thread taking chunks and the
+// dispatcher giving them back. Chunks are only freed with the pool, so it
+// holds on to as many chunks as there were queued histories at the peak
+typedef struct chunkPool {
+  pthread_mutex_t mutex;
+  Chunk *free_chunks;
+} ChunkPool;
+
+ChunkPool *new_chunk_pool();
+
+// only once every history using the pool has been freed
+void free_chunk_pool(ChunkPool *chunk_pool);
 
 typedef struct simulationHistory {
   Chunk *first_chunk;
   Chunk *last_chunk;
+  ChunkPool *chunk_pool; // NULL if chunks are allocated and freed directly
+  bool float_times;
+  int length; // number of rows
+  // the last row as it will be decoded, the next row is encoded from it
+  int last_reaction;
+  double last_time;
 } SimulationHistory;
 
 
-SimulationHistory *new_simulation_history();
+SimulationHistory *new_simulation_history(ChunkPool *chunk_pool,
+                                          bool float_times);
 void free_simulation_history(SimulationHistory *simulation_history);
-void insert_history_element(SimulationHistory *simulation_history, int reaction, double time);
+void insert_history_element(SimulationHistory *simulation_history,
+                            int reaction, int count, double time);
 int simulation_history_length(SimulationHistory *simulation_history);
 
+// reads the rows of a history in order
+typedef struct historyCursor {
+  Chunk *chunk;
+  int index; // byte of chunk->data the next row starts at
+  bool float_times;
+  int last_reaction;
+  double last_time;
+} HistoryCursor;
+
+void start_history_cursor(HistoryCursor *cursor,
+                          SimulationHistory *simulation_history);
+
+// decodes the next row into element. Returns false after the last row
+bool next_history_element(HistoryCursor *cursor, HistoryElement *element);
+
 typedef struct simulation {
   ReactionNetwork *reaction_network;
   unsigned long int seed;
@@ -43,16 +105,62 @@ typedef struct simulation {
   int step; // number of reactions which have occurred
   Solve *solver;
   SimulationHistory *history;
+  // where reset_simulation takes the chunks of the next history from,
+  // and how it encodes times. See set_history_format
+  ChunkPool *chunk_pool;
+  bool float_times;
+  // new propensities of the reactions passed to solver->update_many
+  double *propensity_buffer;
+  // reader slot of the thread running the simulation, used to report
+  // when it holds no dependency nodes. -1 without a dependency memory budget
+  int dependency_reader;
+
+  // species and reactions whose count or propensity changed since the
+  // simulation started, so reset_simulation only restores those.
+  // dirty_log_full is set once the log stops being worth keeping, and
+  // then everything is restored
+  int *dirty_species;
+  int number_of_dirty_species;
+  bool *species_is_dirty;
+  int *dirty_reactions;
+  int number_of_dirty_reactions;
+  bool *reaction_is_dirty;
+  bool dirty_log_full;
 } Simulation;
 
+// once more than 1 / DIRTY_LOG_FRACTION of the reactions are dirty,
+// copying the whole initial solver costs about as much as restoring them
+#define DIRTY_LOG_FRACTION 16
+
 Simulation *new_simulation(ReactionNetwork *reaction_network,
                            unsigned long int seed,
-                           SolveType type);
+                           SolveType type,
+                           SamplerType sampler_type);
 
 // the simulation history is passed to the dispatcher
 // don't free it when freeing the simulation state
 void free_simulation(Simulation *simulation);
 
+// start the simulation over with a new seed and a new history, without
+// allocating anything else. initial_solver is a solver of the same type
+// built from the initial state which is never updated, see reset_solve.
+// Threads running many seeds reuse one simulation this way. Only what
+// the last trajectory changed is restored, see reset_dirty_solve
+void reset_simulation(Simulation *simulation,
+                      Solve *initial_solver,
+                      unsigned long int seed);
+
+// encode the histories of this simulation with chunks from chunk_pool
+// (NULL to allocate them directly) and float times if float_times. Call
+// before the simulation runs, the current history is started over
+void set_history_format(Simulation *simulation,
+                        ChunkPool *chunk_pool,
+                        bool float_times);
+
+// for updates which don't go through step, tau leaping for example.
+// The next reset_simulation restores everything
+void mark_simulation_dirty(Simulation *simulation);
+
 bool step(Simulation *simulation);
 void run_for(Simulation *simulation, int step_cutoff);
 bool check_state_positivity(Simulation *simulation);
@@ -1,18 +1,63 @@
 #include "solvers.h"
 #include <signal.h>
+#include <string.h>
 
 // generic solve
 
+char *solve_type_names[NUMBER_OF_SOLVE_TYPES] = {
+  "linear",
+  "tree",
+  "composition_rejection",
+  "wide_tree",
+  "next_reaction",
+  "integer_tree",
+  "active_set",
+  "sorting_linear",
+  "partial_propensity",
+};
+
+int solve_type_from_name(char *name) {
+  for (int i = 0; i < NUMBER_OF_SOLVE_TYPES; i++)
+    if (strcmp(name, solve_type_names[i]) == 0) return i;
+
+  return -1;
+}
+
 Solve *new_solve(SolveType type,
+                SamplerType sampler_type,
                 unsigned long int seed,
-                int number_of_reactions,
-                double *initial_propensities) {
+                ReactionNetwork *reaction_network,
+                int *state) {
+  int number_of_reactions = reaction_network->number_of_reactions;
+  double *initial_propensities = reaction_network->initial_propensities;
+
   switch (type) {
   case linear:
-    return (Solve *) new_solve_linear(seed, number_of_reactions, initial_propensities);
+    return (Solve *) new_solve_linear(sampler_type, seed, number_of_reactions, initial_propensities);
 
   case tree:
-    return (Solve *) new_solve_tree(seed, number_of_reactions, initial_propensities);
+    return (Solve *) new_solve_tree(sampler_type, seed, number_of_reactions, initial_propensities);
+
+  case composition_rejection:
+    return (Solve *) new_solve_composition(sampler_type, seed, number_of_reactions, initial_propensities);
+
+  case wide_tree:
+    return (Solve *) new_solve_wide_tree(sampler_type, seed, number_of_reactions, initial_propensities);
+
+  case next_reaction:
+    return (Solve *) new_solve_next_reaction(sampler_type, seed, number_of_reactions, initial_propensities);
+
+  case integer_tree:
+    return (Solve *) new_solve_integer_tree(sampler_type, seed, number_of_reactions, initial_propensities);
+
+  case active_set:
+    return (Solve *) new_solve_active_set(sampler_type, seed, number_of_reactions, initial_propensities);
+
+  case sorting_linear:
+    return (Solve *) new_solve_sorting_linear(sampler_type, seed, number_of_reactions, initial_propensities);
+
+  case partial_propensity:
+    return (Solve *) new_solve_partial_propensity(sampler_type, seed, reaction_network, state);
   }
 
   return NULL;
@@ -27,12 +72,129 @@ void free_solve(Solve *p) {
   case tree:
     free_solve_tree((SolveTree *) p);
     break;
+
+  case composition_rejection:
+    free_solve_composition((SolveComposition *) p);
+    break;
+
+  case wide_tree:
+    free_solve_wide_tree((SolveWideTree *) p);
+    break;
+
+  case next_reaction:
+    free_solve_next_reaction((SolveNextReaction *) p);
+    break;
+
+  case integer_tree:
+    free_solve_integer_tree((SolveIntegerTree *) p);
+    break;
+
+  case active_set:
+    free_solve_active_set((SolveActiveSet *) p);
+    break;
+
+  case sorting_linear:
+    free_solve_sorting_linear((SolveSortingLinear *) p);
+    break;
+
+  case partial_propensity:
+    free_solve_partial_propensity((SolvePartialPropensity *) p);
+    break;
     }
 }
 
+void reset_solve(Solve *p, Solve *initial, unsigned long int seed) {
+  reseed_sampler(p->sampler, seed);
+
+  switch (p->type) {
+  case linear:
+    reset_solve_linear((SolveLinear *) p, (SolveLinear *) initial);
+    break;
+
+  case tree:
+    reset_solve_tree((SolveTree *) p, (SolveTree *) initial);
+    break;
+
+  case composition_rejection:
+    reset_solve_composition((SolveComposition *) p,
+                            (SolveComposition *) initial);
+    break;
+
+  case wide_tree:
+    reset_solve_wide_tree((SolveWideTree *) p, (SolveWideTree *) initial);
+    break;
+
+  case next_reaction:
+    reset_solve_next_reaction((SolveNextReaction *) p,
+                              (SolveNextReaction *) initial);
+    break;
+
+  case integer_tree:
+    reset_solve_integer_tree((SolveIntegerTree *) p,
+                             (SolveIntegerTree *) initial);
+    break;
+
+  case active_set:
+    reset_solve_active_set((SolveActiveSet *) p, (SolveActiveSet *) initial);
+    break;
+
+  case sorting_linear:
+    reset_solve_sorting_linear((SolveSortingLinear *) p,
+                               (SolveSortingLinear *) initial);
+    break;
+
+  case partial_propensity:
+    reset_solve_partial_propensity((SolvePartialPropensity *) p,
+                                   (SolvePartialPropensity *) initial);
+    break;
+  }
+}
+
+bool reset_dirty_solve(Solve *p,
+                       Solve *initial,
+                       unsigned long int seed,
+                       int number_of_dirty,
+                       int *dirty,
+                       double *initial_propensities) {
+
+  // the tree solvers refresh the ancestors of the dirty leaves from their
+  // children, so they end up exactly as in initial. Solvers which reorder
+  // reactions or keep running sums don't
+  switch (p->type) {
+  case linear:
+    update_many_solve_linear(p, number_of_dirty, dirty, initial_propensities);
+    ((SolveLinear *) p)->propensity_sum =
+      ((SolveLinear *) initial)->propensity_sum;
+    break;
+
+  case tree:
+    update_many_solve_tree(p, number_of_dirty, dirty, initial_propensities);
+    break;
+
+  case wide_tree:
+    update_many_solve_wide_tree(p, number_of_dirty, dirty, initial_propensities);
+    break;
+
+  case integer_tree:
+    // leaves are quantized with the current scale
+    if (((SolveIntegerTree *) p)->scale != ((SolveIntegerTree *) initial)->scale)
+      return false;
+    update_many_solve_integer_tree(p, number_of_dirty, dirty,
+                                   initial_propensities);
+    break;
+
+  default:
+    return false;
+  }
+
+  reseed_sampler(p->sampler, seed);
+  return true;
+}
+
 // linear solver
 
-SolveLinear *new_solve_linear(unsigned long int seed,
+SolveLinear *new_solve_linear(SamplerType sampler_type,
+                              unsigned long int seed,
                             int number_of_reactions,
                             double *initial_propensities) {
 
@@ -43,8 +205,9 @@ SolveLinear *new_solve_linear(unsigned long int seed,
     p->get_propensity = &get_propensity_solve_linear;
     p->get_propensity_sum = &get_propensity_sum_solve_linear;
     p->get_number_of_active_reactions = &get_number_of_active_reactions_solve_linear;
+    p->update_species = NULL;
     p->type = linear;
-    p->sampler = new_sampler(seed);
+    p->sampler = new_sampler(sampler_type, seed);
     p->number_of_reactions = number_of_reactions;
     p->number_of_active_reactions = 0;
     p->propensities = calloc(number_of_reactions, sizeof(double));
@@ -65,6 +228,13 @@ void free_solve_linear(SolveLinear *p){
   free(p);
 }
 
+void reset_solve_linear(SolveLinear *p, SolveLinear *initial) {
+  memcpy(p->propensities, initial->propensities,
+         p->number_of_reactions * sizeof(double));
+  p->number_of_active_reactions = initial->number_of_active_reactions;
+  p->propensity_sum = initial->propensity_sum;
+}
+
 void update_solve_linear(void *solve_linearp,
                          int reaction_to_update,
                          double new_propensity) {
@@ -83,7 +253,7 @@ void update_many_solve_linear(void *solve_linearp,
   SolveLinear *p = (SolveLinear *) solve_linearp;
   for (int i = 0; i < number_of_updates; i++) {
     int reaction_to_update = reactions_to_update[i];
-    update_solve_linear(p, reaction_to_update, new_propensities[reaction_to_update]);
+    update_solve_linear(p, reaction_to_update, new_propensities[i]);
   }
 }
 
@@ -96,8 +266,8 @@ int event_solve_linear(void *solve_linearp, double *dtp) {
     return -1;
   }
 
-  double r1 = p->sampler->generate(p->sampler);
-  double r2 = p->sampler->generate(p->sampler);
+  double r1 = sample_uniform(p->sampler);
+  double exponential = sample_exponential(p->sampler);
 
   double fraction = p->propensity_sum * r1;
   double partial = 0.0;
@@ -107,7 +277,7 @@ int event_solve_linear(void *solve_linearp, double *dtp) {
     if (partial > fraction) break;
   }
 
-  *dtp = - log(r2) / p->propensity_sum;
+  *dtp = exponential / p->propensity_sum;
 
   if (m < p->number_of_reactions) return m;
   return p->number_of_reactions - 1;
@@ -131,7 +301,8 @@ int get_number_of_active_reactions_solve_linear(void *solve_linearp) {
 
 // tree solver
 
-SolveTree *new_solve_tree(unsigned long int seed,
+SolveTree *new_solve_tree(SamplerType sampler_type,
+                          unsigned long int seed,
                           int number_of_reactions,
                           double *initial_propensities) {
 
@@ -142,8 +313,9 @@ SolveTree *new_solve_tree(unsigned long int seed,
     p->get_propensity = &get_propensity_solve_tree;
     p->get_propensity_sum = &get_propensity_sum_solve_tree;
     p->get_number_of_active_reactions = &get_number_of_active_reactions_solve_tree;
+    p->update_species = NULL;
     p->type = tree;
-    p->sampler = new_sampler(seed);
+    p->sampler = new_sampler(sampler_type, seed);
     p->number_of_reactions = number_of_reactions;
     p->number_of_active_reactions = 0;
 
@@ -158,6 +330,7 @@ SolveTree *new_solve_tree(unsigned long int seed,
     p->number_of_tree_nodes = 2 * pow2 - 1;
     p->propensity_offset = pow2 - 1;
     p->tree = calloc(p->number_of_tree_nodes, sizeof(double));
+    p->dirty = calloc(pow2, sizeof(int));
 
     // initialize tree
     for (int i = 0; i < p->number_of_tree_nodes; i++) p->tree[i] = 0.0;
@@ -180,9 +353,16 @@ SolveTree *new_solve_tree(unsigned long int seed,
 void free_solve_tree(SolveTree *p) {
   free_sampler(p->sampler);
   free(p->tree);
+  free(p->dirty);
   free(p);
 }
 
+void reset_solve_tree(SolveTree *p, SolveTree *initial) {
+  memcpy(p->tree, initial->tree, p->number_of_tree_nodes * sizeof(double));
+  p->number_of_active_reactions = initial->number_of_active_reactions;
+  p->propensity_sum = initial->propensity_sum;
+}
+
 void sum_solve_tree(SolveTree *p) {
   // initialize the tree
   // this function loops through all reactions
@@ -236,11 +416,45 @@ void update_many_solve_tree(void *solve_treep,
                          int number_of_updates,
                          int *reactions_to_update,
                          double *new_propensities) {
-  for (int i = 0; i < number_of_updates; i++) {
-    SolveTree *p = (SolveTree *) solve_treep;
-    int reaction_to_update = reactions_to_update[i];
-    update_solve_tree(p, reaction_to_update, new_propensities[reaction_to_update]);
+  // write all the leaves first, then refresh every dirty ancestor once,
+  // one level at a time. Since all the leaves are on the same level, so
+  // are the dirty nodes at each step. If reactions_to_update is sorted,
+  // so are the dirty nodes and duplicates are adjacent.
+  SolveTree *p = (SolveTree *) solve_treep;
+  int number_of_dirty = 0;
+  int i, j, parent;
+
+  for (i = 0; i < number_of_updates; i++) {
+    int leaf = p->propensity_offset + reactions_to_update[i];
+
+    if (p->tree[leaf] > 0.0) p->number_of_active_reactions--;
+    if (new_propensities[i] > 0.0) p->number_of_active_reactions++;
+    p->tree[leaf] = new_propensities[i];
+
+    if (leaf == 0) continue;
+    parent = (leaf - 1) / 2;
+    if (number_of_dirty == 0 || p->dirty[number_of_dirty - 1] != parent)
+      p->dirty[number_of_dirty++] = parent;
+  }
+
+  while (number_of_dirty > 0) {
+    int number_of_next_dirty = 0;
+    for (j = 0; j < number_of_dirty; j++) {
+      int node = p->dirty[j];
+      p->tree[node] = p->tree[2 * node + 1] + p->tree[2 * node + 2];
+
+      if (node == 0) continue;
+      parent = (node - 1) / 2;
+      // safe to write in place since number_of_next_dirty <= j
+      if (number_of_next_dirty == 0 ||
+          p->dirty[number_of_next_dirty - 1] != parent)
+        p->dirty[number_of_next_dirty++] = parent;
+    }
+    number_of_dirty = number_of_next_dirty;
   }
+
+  // update total propensity
+  p->propensity_sum = p->tree[0];
 }
 
 int find_solve_tree(SolveTree *p, double value) {
@@ -267,7 +481,7 @@ int event_solve_tree(void *solve_treep, double *dtp) {
   SolveTree *p = (SolveTree *) solve_treep;
 
   int m;
-  double r1,r2;
+  double r1,exponential;
 
 
   if (p->number_of_active_reactions == 0) {
@@ -275,13 +489,13 @@ int event_solve_tree(void *solve_treep, double *dtp) {
   }
 
 
-  r1 = p->sampler->generate(p->sampler);
-  r2 = p->sampler->generate(p->sampler);
+  r1 = sample_uniform(p->sampler);
+  exponential = sample_exponential(p->sampler);
 
   double value = r1 * p->propensity_sum;
 
   m = find_solve_tree(p,value);
-  *dtp = - log(r2) / p->propensity_sum;
+  *dtp = exponential / p->propensity_sum;
 
   return m;
 
@@ -305,3 +519,1582 @@ int get_number_of_active_reactions_solve_tree(void *solve_treep) {
   return p->number_of_active_reactions;
 
 }
+
+
+// composition rejection solver
+
+static int composition_group_index(double propensity) {
+  int exponent;
+  frexp(propensity, &exponent);
+  return exponent - COMPOSITION_REJECTION_MIN_EXPONENT;
+}
+
+static void composition_insert(SolveComposition *p, int reaction) {
+  int g = composition_group_index(p->propensities[reaction]);
+  CompositionGroup *group = p->groups + g;
+
+  if (group->number_of_reactions == group->capacity) {
+    group->capacity = group->capacity ? 2 * group->capacity : 16;
+    group->reactions = realloc(group->reactions, group->capacity * sizeof(int));
+  }
+
+  p->group_of_reaction[reaction] = g;
+  p->position_in_group[reaction] = group->number_of_reactions;
+  group->reactions[group->number_of_reactions] = reaction;
+  group->number_of_reactions++;
+  group->propensity_sum += p->propensities[reaction];
+
+  if (g < p->min_group) p->min_group = g;
+  if (g > p->max_group) p->max_group = g;
+}
+
+static void composition_remove(SolveComposition *p, int reaction) {
+  int g = p->group_of_reaction[reaction];
+  CompositionGroup *group = p->groups + g;
+
+  // swap the last reaction of the group into the vacated slot
+  int position = p->position_in_group[reaction];
+  int last_reaction = group->reactions[group->number_of_reactions - 1];
+  group->reactions[position] = last_reaction;
+  p->position_in_group[last_reaction] = position;
+  group->number_of_reactions--;
+
+  // empty groups are reset exactly so round off doesn't accumulate
+  if (group->number_of_reactions == 0) group->propensity_sum = 0.0;
+  else group->propensity_sum -= p->propensities[reaction];
+
+  p->group_of_reaction[reaction] = -1;
+
+  // shrink the range of groups scanned by event_solve_composition
+  while (p->max_group >= p->min_group &&
+         p->groups[p->max_group].number_of_reactions == 0)
+    p->max_group--;
+
+  while (p->min_group <= p->max_group &&
+         p->groups[p->min_group].number_of_reactions == 0)
+    p->min_group++;
+
+  if (p->max_group < p->min_group) {
+    p->min_group = COMPOSITION_REJECTION_NUMBER_OF_GROUPS;
+    p->max_group = -1;
+  }
+}
+
+SolveComposition *new_solve_composition(SamplerType sampler_type,
+                                        unsigned long int seed,
+                                        int number_of_reactions,
+                                        double *initial_propensities) {
+
+  SolveComposition *p = calloc(1, sizeof(SolveComposition));
+  p->update = &update_solve_composition;
+  p->update_many = &update_many_solve_composition;
+  p->event = &event_solve_composition;
+  p->get_propensity = &get_propensity_solve_composition;
+  p->get_propensity_sum = &get_propensity_sum_solve_composition;
+  p->get_number_of_active_reactions =
+    &get_number_of_active_reactions_solve_composition;
+  p->update_species = NULL;
+  p->type = composition_rejection;
+  p->sampler = new_sampler(sampler_type, seed);
+  p->number_of_reactions = number_of_reactions;
+  p->number_of_active_reactions = 0;
+  p->propensities = calloc(number_of_reactions, sizeof(double));
+  p->group_of_reaction = calloc(number_of_reactions, sizeof(int));
+  p->position_in_group = calloc(number_of_reactions, sizeof(int));
+  p->groups = calloc(COMPOSITION_REJECTION_NUMBER_OF_GROUPS,
+                     sizeof(CompositionGroup));
+
+  for (int g = 0; g < COMPOSITION_REJECTION_NUMBER_OF_GROUPS; g++)
+    p->groups[g].max_propensity =
+      ldexp(1.0, g + COMPOSITION_REJECTION_MIN_EXPONENT);
+
+  // empty range
+  p->min_group = COMPOSITION_REJECTION_NUMBER_OF_GROUPS;
+  p->max_group = -1;
+  p->propensity_sum = 0.0;
+
+  for (int i = 0; i < number_of_reactions; i++) {
+    p->propensities[i] = initial_propensities[i];
+    p->group_of_reaction[i] = -1;
+    if (initial_propensities[i] > 0.0) {
+      p->number_of_active_reactions++;
+      p->propensity_sum += initial_propensities[i];
+      composition_insert(p, i);
+    }
+  }
+
+  return p;
+}
+
+void free_solve_composition(SolveComposition *p) {
+  free_sampler(p->sampler);
+  for (int g = 0; g < COMPOSITION_REJECTION_NUMBER_OF_GROUPS; g++)
+    free(p->groups[g].reactions);
+  free(p->groups);
+  free(p->position_in_group);
+  free(p->group_of_reaction);
+  free(p->propensities);
+  free(p);
+}
+
+void reset_solve_composition(SolveComposition *p, SolveComposition *initial) {
+  int number_of_reactions = p->number_of_reactions;
+
+  memcpy(p->propensities, initial->propensities,
+         number_of_reactions * sizeof(double));
+  memcpy(p->group_of_reaction, initial->group_of_reaction,
+         number_of_reactions * sizeof(int));
+  memcpy(p->position_in_group, initial->position_in_group,
+         number_of_reactions * sizeof(int));
+
+  // the arrays of the groups may be smaller than those of initial
+  for (int g = 0; g < COMPOSITION_REJECTION_NUMBER_OF_GROUPS; g++) {
+    CompositionGroup *group = p->groups + g;
+    CompositionGroup *initial_group = initial->groups + g;
+
+    if (group->capacity < initial_group->number_of_reactions) {
+      group->capacity = initial_group->capacity;
+      group->reactions = realloc(group->reactions, group->capacity * sizeof(int));
+    }
+
+    if (initial_group->number_of_reactions)
+      memcpy(group->reactions, initial_group->reactions,
+             initial_group->number_of_reactions * sizeof(int));
+    group->number_of_reactions = initial_group->number_of_reactions;
+    group->propensity_sum = initial_group->propensity_sum;
+  }
+
+  p->min_group = initial->min_group;
+  p->max_group = initial->max_group;
+  p->number_of_active_reactions = initial->number_of_active_reactions;
+  p->propensity_sum = initial->propensity_sum;
+}
+
+void update_solve_composition(void *solve_compositionp,
+                              int reaction_to_update,
+                              double new_propensity) {
+  SolveComposition *p = (SolveComposition *) solve_compositionp;
+  double old_propensity = p->propensities[reaction_to_update];
+
+  if (old_propensity > 0.0) p->number_of_active_reactions--;
+  if (new_propensity > 0.0) p->number_of_active_reactions++;
+  p->propensity_sum -= old_propensity;
+  p->propensity_sum += new_propensity;
+
+  int old_group = p->group_of_reaction[reaction_to_update];
+  int new_group = new_propensity > 0.0 ?
+    composition_group_index(new_propensity) : -1;
+
+  if (old_group == new_group) {
+    // common case: the reaction stays in its group
+    if (new_group >= 0)
+      p->groups[new_group].propensity_sum += new_propensity - old_propensity;
+    p->propensities[reaction_to_update] = new_propensity;
+    return;
+  }
+
+  if (old_group >= 0) composition_remove(p, reaction_to_update);
+  p->propensities[reaction_to_update] = new_propensity;
+  if (new_group >= 0) composition_insert(p, reaction_to_update);
+}
+
+void update_many_solve_composition(void *solve_compositionp,
+                                   int number_of_updates,
+                                   int *reactions_to_update,
+                                   double *new_propensities) {
+  SolveComposition *p = (SolveComposition *) solve_compositionp;
+  for (int i = 0; i < number_of_updates; i++) {
+    int reaction_to_update = reactions_to_update[i];
+    update_solve_composition(p, reaction_to_update, new_propensities[i]);
+  }
+}
+
+int event_solve_composition(void *solve_compositionp, double *dtp) {
+  SolveComposition *p = (SolveComposition *) solve_compositionp;
+
+  if (p->number_of_active_reactions == 0) {
+    p->propensity_sum = 0.0;
+    return -1;
+  }
+
+  double r1 = sample_uniform(p->sampler);
+  double exponential = sample_exponential(p->sampler);
+
+  // composition: pick a group. Largest groups are scanned first
+  double fraction = p->propensity_sum * r1;
+  double partial = 0.0;
+  int g;
+  int selected_group = -1;
+
+  for (g = p->max_group; g >= p->min_group; g--) {
+    if (p->groups[g].number_of_reactions == 0) continue;
+    selected_group = g;
+    partial += p->groups[g].propensity_sum;
+    if (partial > fraction) break;
+  }
+
+  // rejection: pick a reaction uniformly from the group and accept it with
+  // probability propensity / max_propensity. The integer part of the
+  // scaled random number picks the reaction and the fractional part is
+  // used for the acceptance test.
+  CompositionGroup *group = p->groups + selected_group;
+  int reaction;
+  while (true) {
+    double r = sample_uniform(p->sampler) * group->number_of_reactions;
+    int index = (int) r;
+    if (index == group->number_of_reactions) index--;
+    reaction = group->reactions[index];
+    if ((r - index) * group->max_propensity < p->propensities[reaction])
+      break;
+  }
+
+  *dtp = exponential / p->propensity_sum;
+  return reaction;
+}
+
+double get_propensity_solve_composition(void *solve_compositionp, int reaction) {
+  SolveComposition *p = (SolveComposition *) solve_compositionp;
+  return p->propensities[reaction];
+}
+
+double get_propensity_sum_solve_composition(void *solve_compositionp) {
+  SolveComposition *p = (SolveComposition *) solve_compositionp;
+  return p->propensity_sum;
+}
+
+int get_number_of_active_reactions_solve_composition(void *solve_compositionp) {
+  SolveComposition *p = (SolveComposition *) solve_compositionp;
+  return p->number_of_active_reactions;
+}
+
+
+// wide tree solver
+
+SolveWideTree *new_solve_wide_tree(SamplerType sampler_type,
+                                   unsigned long int seed,
+                                   int number_of_reactions,
+                                   double *initial_propensities) {
+
+  SolveWideTree *p = calloc(1, sizeof(SolveWideTree));
+  p->update = &update_solve_wide_tree;
+  p->update_many = &update_many_solve_wide_tree;
+  p->event = &event_solve_wide_tree;
+  p->get_propensity = &get_propensity_solve_wide_tree;
+  p->get_propensity_sum = &get_propensity_sum_solve_wide_tree;
+  p->get_number_of_active_reactions =
+    &get_number_of_active_reactions_solve_wide_tree;
+  p->update_species = NULL;
+  p->type = wide_tree;
+  p->sampler = new_sampler(sampler_type, seed);
+  p->number_of_reactions = number_of_reactions;
+  p->number_of_active_reactions = 0;
+
+  // compute level sizes from the leaves up. Each level is padded
+  // to a multiple of WIDE_TREE_ARITY
+  int level_size[WIDE_TREE_MAX_DEPTH];
+  int depth = 0;
+  int nodes = number_of_reactions;
+
+  while (true) {
+    level_size[depth] =
+      (nodes + WIDE_TREE_ARITY - 1) / WIDE_TREE_ARITY * WIDE_TREE_ARITY;
+    depth++;
+    // there is always a root level above the leaves
+    if (nodes <= 1 && depth > 1) break;
+    nodes = (nodes + WIDE_TREE_ARITY - 1) / WIDE_TREE_ARITY;
+  }
+
+  // level_size was filled leaves first
+  p->depth = depth;
+  p->number_of_tree_nodes = 0;
+  for (int d = 0; d < depth; d++) {
+    p->level_offset[d] = p->number_of_tree_nodes;
+    p->number_of_tree_nodes += level_size[depth - 1 - d];
+  }
+
+  p->tree = aligned_alloc(64, p->number_of_tree_nodes * sizeof(double));
+  // a parent per update in the worst case, when updates aren't sorted
+  p->dirty = calloc(number_of_reactions, sizeof(int));
+  for (int i = 0; i < p->number_of_tree_nodes; i++) p->tree[i] = 0.0;
+
+  double *leaves = p->tree + p->level_offset[depth - 1];
+  for (int i = 0; i < number_of_reactions; i++)
+    leaves[i] = initial_propensities[i];
+
+  sum_solve_wide_tree(p);
+
+  return p;
+}
+
+void free_solve_wide_tree(SolveWideTree *p) {
+  free_sampler(p->sampler);
+  free(p->tree);
+  free(p->dirty);
+  free(p);
+}
+
+void reset_solve_wide_tree(SolveWideTree *p, SolveWideTree *initial) {
+  memcpy(p->tree, initial->tree, p->number_of_tree_nodes * sizeof(double));
+  p->number_of_active_reactions = initial->number_of_active_reactions;
+  p->propensity_sum = initial->propensity_sum;
+}
+
+// sum of the WIDE_TREE_ARITY children starting at block.
+// always summed in the same order, so a parent is bitwise equal
+// to the last prefix sum computed by find_solve_wide_tree
+static inline double wide_tree_block_sum(double *block) {
+  double sum = 0.0;
+  for (int c = 0; c < WIDE_TREE_ARITY; c++) sum += block[c];
+  return sum;
+}
+
+void sum_solve_wide_tree(SolveWideTree *p) {
+  // initialize the interior nodes
+  // this function loops through all reactions
+  // should never be run during an active simulation
+  for (int d = p->depth - 2; d >= 0; d--) {
+    int child_level_end = d + 2 < p->depth ?
+      p->level_offset[d + 2] : p->number_of_tree_nodes;
+    int number_of_blocks =
+      (child_level_end - p->level_offset[d + 1]) / WIDE_TREE_ARITY;
+    for (int k = 0; k < number_of_blocks; k++)
+      p->tree[p->level_offset[d] + k] = wide_tree_block_sum(
+        p->tree + p->level_offset[d + 1] + WIDE_TREE_ARITY * k);
+  }
+
+  p->propensity_sum = p->tree[0];
+  p->number_of_active_reactions = 0;
+
+  double *leaves = p->tree + p->level_offset[p->depth - 1];
+  for (int i = 0; i < p->number_of_reactions; i++)
+    if (leaves[i] > 0.0) p->number_of_active_reactions++;
+}
+
+void update_solve_wide_tree(void *solve_wide_treep,
+                            int reaction_to_update,
+                            double new_propensity) {
+  SolveWideTree *p = (SolveWideTree *) solve_wide_treep;
+  double *leaves = p->tree + p->level_offset[p->depth - 1];
+
+  // update number of active reactions
+  if (leaves[reaction_to_update] > 0.0) p->number_of_active_reactions--;
+  if (new_propensity > 0.0) p->number_of_active_reactions++;
+
+  // set new propensity
+  leaves[reaction_to_update] = new_propensity;
+
+  // propogate new propensity up to root, one cache line per level
+  int k = reaction_to_update;
+  for (int d = p->depth - 1; d > 0; d--) {
+    k /= WIDE_TREE_ARITY;
+    p->tree[p->level_offset[d - 1] + k] = wide_tree_block_sum(
+      p->tree + p->level_offset[d] + WIDE_TREE_ARITY * k);
+  }
+
+  p->propensity_sum = p->tree[0];
+}
+
+void update_many_solve_wide_tree(void *solve_wide_treep,
+                                 int number_of_updates,
+                                 int *reactions_to_update,
+                                 double *new_propensities) {
+  // write all the leaves first, then refresh every dirty ancestor once,
+  // one level at a time. See update_many_solve_tree
+  SolveWideTree *p = (SolveWideTree *) solve_wide_treep;
+  double *leaves = p->tree + p->level_offset[p->depth - 1];
+  int number_of_dirty = 0;
+  int i, j, d, parent;
+
+  for (i = 0; i < number_of_updates; i++) {
+    int reaction_to_update = reactions_to_update[i];
+
+    if (leaves[reaction_to_update] > 0.0) p->number_of_active_reactions--;
+    if (new_propensities[i] > 0.0) p->number_of_active_reactions++;
+    leaves[reaction_to_update] = new_propensities[i];
+
+    parent = reaction_to_update / WIDE_TREE_ARITY;
+    if (number_of_dirty == 0 || p->dirty[number_of_dirty - 1] != parent)
+      p->dirty[number_of_dirty++] = parent;
+  }
+
+  for (d = p->depth - 1; d > 0; d--) {
+    int number_of_next_dirty = 0;
+    for (j = 0; j < number_of_dirty; j++) {
+      int node = p->dirty[j];
+      p->tree[p->level_offset[d - 1] + node] = wide_tree_block_sum(
+        p->tree + p->level_offset[d] + WIDE_TREE_ARITY * node);
+
+      parent = node / WIDE_TREE_ARITY;
+      // safe to write in place since number_of_next_dirty <= j
+      if (number_of_next_dirty == 0 ||
+          p->dirty[number_of_next_dirty - 1] != parent)
+        p->dirty[number_of_next_dirty++] = parent;
+    }
+    number_of_dirty = number_of_next_dirty;
+  }
+
+  p->propensity_sum = p->tree[0];
+}
+
+int find_solve_wide_tree(SolveWideTree *p, double value) {
+  // walk tree from root to appropriate leaf
+  // value is reduced by the children to the left of the chosen child
+  int k = 0;
+
+  for (int d = 1; d < p->depth; d++) {
+    double *block = p->tree + p->level_offset[d] + WIDE_TREE_ARITY * k;
+    double prefix[WIDE_TREE_ARITY];
+    int c = 0;
+
+    prefix[0] = block[0];
+    for (int j = 1; j < WIDE_TREE_ARITY; j++)
+      prefix[j] = prefix[j - 1] + block[j];
+
+    // branch free: the chosen child is the first with prefix >= value
+    for (int j = 0; j < WIDE_TREE_ARITY; j++)
+      c += prefix[j] < value;
+
+    // only reachable through round off
+    if (c == WIDE_TREE_ARITY) c--;
+    while (c > 0 && block[c] == 0.0) c--;
+
+    if (c > 0) value -= prefix[c - 1];
+    k = WIDE_TREE_ARITY * k + c;
+  }
+
+  return k;
+}
+
+int event_solve_wide_tree(void *solve_wide_treep, double *dtp) {
+  SolveWideTree *p = (SolveWideTree *) solve_wide_treep;
+
+  if (p->number_of_active_reactions == 0) {
+    return -1;
+  }
+
+  double r1 = sample_uniform(p->sampler);
+  double exponential = sample_exponential(p->sampler);
+
+  double value = r1 * p->propensity_sum;
+
+  int m = find_solve_wide_tree(p, value);
+  *dtp = exponential / p->propensity_sum;
+
+  return m;
+}
+
+double get_propensity_solve_wide_tree(void *solve_wide_treep, int reaction) {
+  SolveWideTree *p = (SolveWideTree *) solve_wide_treep;
+  return p->tree[p->level_offset[p->depth - 1] + reaction];
+}
+
+double get_propensity_sum_solve_wide_tree(void *solve_wide_treep) {
+  SolveWideTree *p = (SolveWideTree *) solve_wide_treep;
+  return p->propensity_sum;
+}
+
+int get_number_of_active_reactions_solve_wide_tree(void *solve_wide_treep) {
+  SolveWideTree *p = (SolveWideTree *) solve_wide_treep;
+  return p->number_of_active_reactions;
+}
+
+
+// next reaction solver
+
+static double next_reaction_draw_time(SolveNextReaction *p, double propensity) {
+  if (propensity > 0.0)
+    return p->time + sample_exponential(p->sampler) / propensity;
+  else
+    return INFINITY;
+}
+
+static void next_reaction_swap(SolveNextReaction *p, int i, int j) {
+  int reaction_i = p->heap[i];
+  int reaction_j = p->heap[j];
+  p->heap[i] = reaction_j;
+  p->heap[j] = reaction_i;
+  p->heap_position[reaction_j] = i;
+  p->heap_position[reaction_i] = j;
+}
+
+static void next_reaction_sift_up(SolveNextReaction *p, int i) {
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (p->firing_times[p->heap[parent]] <= p->firing_times[p->heap[i]])
+      break;
+    next_reaction_swap(p, i, parent);
+    i = parent;
+  }
+}
+
+static void next_reaction_sift_down(SolveNextReaction *p, int i) {
+  while (true) {
+    int smallest = i;
+    int left_child = 2 * i + 1;
+    int right_child = 2 * i + 2;
+
+    if (left_child < p->number_of_reactions &&
+        p->firing_times[p->heap[left_child]] < p->firing_times[p->heap[smallest]])
+      smallest = left_child;
+
+    if (right_child < p->number_of_reactions &&
+        p->firing_times[p->heap[right_child]] < p->firing_times[p->heap[smallest]])
+      smallest = right_child;
+
+    if (smallest == i) break;
+    next_reaction_swap(p, i, smallest);
+    i = smallest;
+  }
+}
+
+// draws a firing time for every reaction at time 0 and builds the heap
+static void next_reaction_initialize(SolveNextReaction *p,
+                                     double *initial_propensities) {
+  int number_of_reactions = p->number_of_reactions;
+
+  p->number_of_active_reactions = 0;
+  p->propensity_sum = 0.0;
+
+  for (int i = 0; i < number_of_reactions; i++) {
+    if (initial_propensities[i] > 0.0) p->number_of_active_reactions++;
+    p->propensities[i] = initial_propensities[i];
+    p->propensity_sum += initial_propensities[i];
+    p->firing_times[i] = next_reaction_draw_time(p, initial_propensities[i]);
+    p->heap[i] = i;
+    p->heap_position[i] = i;
+  }
+
+  // heapify
+  for (int i = number_of_reactions / 2 - 1; i >= 0; i--)
+    next_reaction_sift_down(p, i);
+}
+
+SolveNextReaction *new_solve_next_reaction(SamplerType sampler_type,
+                                           unsigned long int seed,
+                                           int number_of_reactions,
+                                           double *initial_propensities) {
+
+  SolveNextReaction *p = calloc(1, sizeof(SolveNextReaction));
+  p->update = &update_solve_next_reaction;
+  p->update_many = &update_many_solve_next_reaction;
+  p->event = &event_solve_next_reaction;
+  p->get_propensity = &get_propensity_solve_next_reaction;
+  p->get_propensity_sum = &get_propensity_sum_solve_next_reaction;
+  p->get_number_of_active_reactions =
+    &get_number_of_active_reactions_solve_next_reaction;
+  p->update_species = NULL;
+  p->type = next_reaction;
+  p->sampler = new_sampler(sampler_type, seed);
+  p->number_of_reactions = number_of_reactions;
+  p->number_of_active_reactions = 0;
+  p->propensities = calloc(number_of_reactions, sizeof(double));
+  p->firing_times = calloc(number_of_reactions, sizeof(double));
+  p->heap = calloc(number_of_reactions, sizeof(int));
+  p->heap_position = calloc(number_of_reactions, sizeof(int));
+  p->time = 0.0;
+  p->last_fired = -1;
+  next_reaction_initialize(p, initial_propensities);
+
+  return p;
+}
+
+void free_solve_next_reaction(SolveNextReaction *p) {
+  free_sampler(p->sampler);
+  free(p->propensities);
+  free(p->firing_times);
+  free(p->heap);
+  free(p->heap_position);
+  free(p);
+}
+
+void reset_solve_next_reaction(SolveNextReaction *p, SolveNextReaction *initial) {
+  p->time = 0.0;
+  p->last_fired = -1;
+  next_reaction_initialize(p, initial->propensities);
+}
+
+void update_solve_next_reaction(void *solve_next_reactionp,
+                                int reaction_to_update,
+                                double new_propensity) {
+  SolveNextReaction *p = (SolveNextReaction *) solve_next_reactionp;
+  double old_propensity = p->propensities[reaction_to_update];
+  double old_firing_time = p->firing_times[reaction_to_update];
+  double new_firing_time;
+
+  if (old_propensity > 0.0) p->number_of_active_reactions--;
+  if (new_propensity > 0.0) p->number_of_active_reactions++;
+  p->propensity_sum -= old_propensity;
+  p->propensity_sum += new_propensity;
+  p->propensities[reaction_to_update] = new_propensity;
+
+  if (reaction_to_update == p->last_fired) {
+    // the reaction which just fired needs a fresh waiting time
+    new_firing_time = next_reaction_draw_time(p, new_propensity);
+    p->last_fired = -1;
+  }
+  else if (new_propensity == old_propensity)
+    return;
+  else if (old_propensity > 0.0 && new_propensity > 0.0)
+    new_firing_time = p->time + (old_propensity / new_propensity)
+      * (old_firing_time - p->time);
+  else
+    // the reaction is switching on or off. Waiting times are memoryless,
+    // so drawing a new one is equivalent to remembering the old one
+    new_firing_time = next_reaction_draw_time(p, new_propensity);
+
+  p->firing_times[reaction_to_update] = new_firing_time;
+
+  int i = p->heap_position[reaction_to_update];
+  if (new_firing_time < old_firing_time) next_reaction_sift_up(p, i);
+  else next_reaction_sift_down(p, i);
+}
+
+void update_many_solve_next_reaction(void *solve_next_reactionp,
+                                     int number_of_updates,
+                                     int *reactions_to_update,
+                                     double *new_propensities) {
+  SolveNextReaction *p = (SolveNextReaction *) solve_next_reactionp;
+  for (int i = 0; i < number_of_updates; i++)
+    update_solve_next_reaction(p, reactions_to_update[i], new_propensities[i]);
+}
+
+int event_solve_next_reaction(void *solve_next_reactionp, double *dtp) {
+  SolveNextReaction *p = (SolveNextReaction *) solve_next_reactionp;
+
+  // a reaction which doesn't depend on its own reactants
+  // (e.g zero reactants) is not updated after it fires
+  if (p->last_fired >= 0)
+    update_solve_next_reaction(p, p->last_fired,
+                               p->propensities[p->last_fired]);
+
+  if (p->number_of_active_reactions == 0) {
+    p->propensity_sum = 0.0;
+    return -1;
+  }
+
+  int m = p->heap[0];
+  *dtp = p->firing_times[m] - p->time;
+  p->time = p->firing_times[m];
+  p->last_fired = m;
+
+  return m;
+}
+
+double get_propensity_solve_next_reaction(void *solve_next_reactionp, int reaction) {
+  SolveNextReaction *p = (SolveNextReaction *) solve_next_reactionp;
+  return p->propensities[reaction];
+}
+
+double get_propensity_sum_solve_next_reaction(void *solve_next_reactionp) {
+  SolveNextReaction *p = (SolveNextReaction *) solve_next_reactionp;
+  return p->propensity_sum;
+}
+
+int get_number_of_active_reactions_solve_next_reaction(void *solve_next_reactionp) {
+  SolveNextReaction *p = (SolveNextReaction *) solve_next_reactionp;
+  return p->number_of_active_reactions;
+}
+
+
+// integer tree solver
+
+static inline uint64_t integer_tree_quantize(SolveIntegerTree *p, double propensity) {
+  if (propensity <= 0.0) return 0;
+  uint64_t value = (uint64_t) (propensity * p->scale + 0.5);
+  return value > 0 ? value : 1;
+}
+
+// true if propensity can't be quantized with the current scale. The
+// conversion would overflow, so the tree has to be rescaled instead
+static inline bool integer_tree_too_large(SolveIntegerTree *p, double propensity) {
+  return propensity * p->scale >
+    (double) ((uint64_t) 1 << INTEGER_TREE_MAX_BITS);
+}
+
+// true if the root has left the range where the scale is useful
+static inline bool integer_tree_out_of_range(SolveIntegerTree *p) {
+  return p->tree[0] > ((uint64_t) 1 << INTEGER_TREE_MAX_BITS) ||
+    (p->tree[0] > 0 && p->tree[0] < ((uint64_t) 1 << INTEGER_TREE_MIN_BITS));
+}
+
+SolveIntegerTree *new_solve_integer_tree(SamplerType sampler_type,
+                                         unsigned long int seed,
+                                         int number_of_reactions,
+                                         double *initial_propensities) {
+
+  SolveIntegerTree *p = calloc(1, sizeof(SolveIntegerTree));
+  p->update = &update_solve_integer_tree;
+  p->update_many = &update_many_solve_integer_tree;
+  p->event = &event_solve_integer_tree;
+  p->get_propensity = &get_propensity_solve_integer_tree;
+  p->get_propensity_sum = &get_propensity_sum_solve_integer_tree;
+  p->get_number_of_active_reactions =
+    &get_number_of_active_reactions_solve_integer_tree;
+  p->update_species = NULL;
+  p->type = integer_tree;
+  p->sampler = new_sampler(sampler_type, seed);
+  p->number_of_reactions = number_of_reactions;
+
+  int pow2 = 1;  // power of 2 >= numberOfReactions
+  while (pow2 < number_of_reactions) pow2 *= 2;
+
+  p->number_of_tree_nodes = 2 * pow2 - 1;
+  p->propensity_offset = pow2 - 1;
+  p->tree = calloc(p->number_of_tree_nodes, sizeof(uint64_t));
+  p->propensities = calloc(number_of_reactions, sizeof(double));
+  p->dirty = calloc(pow2, sizeof(int));
+
+  for (int i = 0; i < number_of_reactions; i++)
+    p->propensities[i] = initial_propensities[i];
+
+  // sets scale, the tree, the propensity sum
+  // and the number of active reactions
+  rescale_solve_integer_tree(p);
+
+  return p;
+}
+
+void free_solve_integer_tree(SolveIntegerTree *p) {
+  free_sampler(p->sampler);
+  free(p->tree);
+  free(p->propensities);
+  free(p->dirty);
+  free(p);
+}
+
+void reset_solve_integer_tree(SolveIntegerTree *p, SolveIntegerTree *initial) {
+  memcpy(p->tree, initial->tree, p->number_of_tree_nodes * sizeof(uint64_t));
+  memcpy(p->propensities, initial->propensities,
+         p->number_of_reactions * sizeof(double));
+  p->scale = initial->scale;
+  p->number_of_active_reactions = initial->number_of_active_reactions;
+  p->propensity_sum = initial->propensity_sum;
+}
+
+void rescale_solve_integer_tree(SolveIntegerTree *p) {
+  // loops through all reactions, only happens when the total propensity
+  // has changed by a factor of 2^16 since the last rescale
+  double sum = 0.0;
+  p->number_of_active_reactions = 0;
+  for (int i = 0; i < p->number_of_reactions; i++) {
+    sum += p->propensities[i];
+    if (p->propensities[i] > 0.0) p->number_of_active_reactions++;
+  }
+
+  int exponent = 0;
+  if (sum > 0.0) frexp(sum, &exponent);
+  p->scale = ldexp(1.0, INTEGER_TREE_TARGET_BITS - exponent);
+
+  for (int i = 0; i < p->number_of_reactions; i++)
+    p->tree[p->propensity_offset + i] =
+      integer_tree_quantize(p, p->propensities[i]);
+
+  for (int parent = p->propensity_offset - 1; parent >= 0; parent--)
+    p->tree[parent] = p->tree[2 * parent + 1] + p->tree[2 * parent + 2];
+
+  p->propensity_sum = p->tree[0] / p->scale;
+}
+
+void update_solve_integer_tree(void *solve_integer_treep,
+                               int reaction_to_update,
+                               double new_propensity) {
+  SolveIntegerTree *p = (SolveIntegerTree *) solve_integer_treep;
+
+  if (p->propensities[reaction_to_update] > 0.0) p->number_of_active_reactions--;
+  if (new_propensity > 0.0) p->number_of_active_reactions++;
+  p->propensities[reaction_to_update] = new_propensity;
+
+  if (integer_tree_too_large(p, new_propensity)) {
+    rescale_solve_integer_tree(p);
+    return;
+  }
+
+  int i = p->propensity_offset + reaction_to_update;
+  p->tree[i] = integer_tree_quantize(p, new_propensity);
+
+  // propogate new propensity up to root
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    p->tree[parent] = p->tree[2 * parent + 1] + p->tree[2 * parent + 2];
+    i = parent;
+  }
+
+  if (integer_tree_out_of_range(p)) rescale_solve_integer_tree(p);
+  p->propensity_sum = p->tree[0] / p->scale;
+}
+
+void update_many_solve_integer_tree(void *solve_integer_treep,
+                                    int number_of_updates,
+                                    int *reactions_to_update,
+                                    double *new_propensities) {
+  // write all the leaves first, then refresh every dirty ancestor once,
+  // one level at a time. See update_many_solve_tree
+  SolveIntegerTree *p = (SolveIntegerTree *) solve_integer_treep;
+  int number_of_dirty = 0;
+  int i, j, parent;
+  // the root is at most 2^INTEGER_TREE_MAX_BITS before the updates, so
+  // as long as the new leaves add up to no more than that it can't wrap
+  uint64_t added = 0;
+  bool rescale = false;
+
+  for (i = 0; i < number_of_updates; i++) {
+    int reaction_to_update = reactions_to_update[i];
+    int leaf = p->propensity_offset + reaction_to_update;
+
+    if (p->propensities[reaction_to_update] > 0.0)
+      p->number_of_active_reactions--;
+    if (new_propensities[i] > 0.0) p->number_of_active_reactions++;
+    p->propensities[reaction_to_update] = new_propensities[i];
+
+    // the remaining propensities still need recording
+    if (rescale) continue;
+    if (integer_tree_too_large(p, new_propensities[i])) {
+      rescale = true;
+      continue;
+    }
+
+    p->tree[leaf] = integer_tree_quantize(p, new_propensities[i]);
+    added += p->tree[leaf];
+    if (added > ((uint64_t) 1 << INTEGER_TREE_MAX_BITS)) {
+      rescale = true;
+      continue;
+    }
+
+    if (leaf == 0) continue;
+    parent = (leaf - 1) / 2;
+    if (number_of_dirty == 0 || p->dirty[number_of_dirty - 1] != parent)
+      p->dirty[number_of_dirty++] = parent;
+  }
+
+  // the tree is rebuilt from the propensities
+  if (rescale) {
+    rescale_solve_integer_tree(p);
+    return;
+  }
+
+  while (number_of_dirty > 0) {
+    int number_of_next_dirty = 0;
+    for (j = 0; j < number_of_dirty; j++) {
+      int node = p->dirty[j];
+      p->tree[node] = p->tree[2 * node + 1] + p->tree[2 * node + 2];
+
+      if (node == 0) continue;
+      parent = (node - 1) / 2;
+      // safe to write in place since number_of_next_dirty <= j
+      if (number_of_next_dirty == 0 ||
+          p->dirty[number_of_next_dirty - 1] != parent)
+        p->dirty[number_of_next_dirty++] = parent;
+    }
+    number_of_dirty = number_of_next_dirty;
+  }
+
+  if (integer_tree_out_of_range(p)) rescale_solve_integer_tree(p);
+  p->propensity_sum = p->tree[0] / p->scale;
+}
+
+int find_solve_integer_tree(SolveIntegerTree *p, uint64_t value) {
+  // walk tree from root to appropriate leaf. value < tree[i] holds at
+  // every node, so we always end up at a leaf with nonzero propensity
+  int i = 0;
+  while (i < p->propensity_offset) {
+    int left_child = 2 * i + 1;
+    if (value < p->tree[left_child]) i = left_child;
+    else {
+      value -= p->tree[left_child];
+      i = left_child + 1;
+    }
+  }
+  return i - p->propensity_offset;
+}
+
+int event_solve_integer_tree(void *solve_integer_treep, double *dtp) {
+  SolveIntegerTree *p = (SolveIntegerTree *) solve_integer_treep;
+
+  if (p->number_of_active_reactions == 0) {
+    return -1;
+  }
+
+  double r1 = sample_uniform(p->sampler);
+  double exponential = sample_exponential(p->sampler);
+
+  // a single integer target in [0, tree[0])
+  uint64_t value = (uint64_t) (r1 * p->tree[0]);
+  if (value >= p->tree[0]) value = p->tree[0] - 1;
+
+  int m = find_solve_integer_tree(p, value);
+  *dtp = exponential / p->propensity_sum;
+
+  return m;
+}
+
+double get_propensity_solve_integer_tree(void *solve_integer_treep, int reaction) {
+  SolveIntegerTree *p = (SolveIntegerTree *) solve_integer_treep;
+  return p->propensities[reaction];
+}
+
+double get_propensity_sum_solve_integer_tree(void *solve_integer_treep) {
+  SolveIntegerTree *p = (SolveIntegerTree *) solve_integer_treep;
+  return p->propensity_sum;
+}
+
+int get_number_of_active_reactions_solve_integer_tree(void *solve_integer_treep) {
+  SolveIntegerTree *p = (SolveIntegerTree *) solve_integer_treep;
+  return p->number_of_active_reactions;
+}
+
+
+// active set solver
+
+// leaves of the tree start at capacity - 1
+static void active_set_set_slot(SolveActiveSet *p, int slot, double propensity) {
+  int i = p->capacity - 1 + slot;
+  p->tree[i] = propensity;
+
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    p->tree[parent] = p->tree[2 * parent + 1] + p->tree[2 * parent + 2];
+    i = parent;
+  }
+}
+
+// allocate a tree with new_capacity slots and copy the active slots into it
+static void active_set_resize(SolveActiveSet *p, int new_capacity) {
+  double *old_tree = p->tree;
+  int old_capacity = p->capacity;
+
+  p->capacity = new_capacity;
+  p->active_reactions = realloc(p->active_reactions, new_capacity * sizeof(int));
+  p->tree = calloc(2 * new_capacity - 1, sizeof(double));
+
+  for (int slot = 0; slot < p->number_of_active_reactions; slot++)
+    p->tree[new_capacity - 1 + slot] = old_tree[old_capacity - 1 + slot];
+
+  for (int parent = new_capacity - 2; parent >= 0; parent--)
+    p->tree[parent] = p->tree[2 * parent + 1] + p->tree[2 * parent + 2];
+
+  free(old_tree);
+}
+
+SolveActiveSet *new_solve_active_set(SamplerType sampler_type,
+                                     unsigned long int seed,
+                                     int number_of_reactions,
+                                     double *initial_propensities) {
+
+  SolveActiveSet *p = calloc(1, sizeof(SolveActiveSet));
+  p->update = &update_solve_active_set;
+  p->update_many = &update_many_solve_active_set;
+  p->event = &event_solve_active_set;
+  p->get_propensity = &get_propensity_solve_active_set;
+  p->get_propensity_sum = &get_propensity_sum_solve_active_set;
+  p->get_number_of_active_reactions =
+    &get_number_of_active_reactions_solve_active_set;
+  p->update_species = NULL;
+  p->type = active_set;
+  p->sampler = new_sampler(sampler_type, seed);
+  p->number_of_reactions = number_of_reactions;
+  p->number_of_active_reactions = 0;
+  p->position = calloc(number_of_reactions, sizeof(int));
+
+  int initially_active = 0;
+  for (int i = 0; i < number_of_reactions; i++)
+    if (initial_propensities[i] > 0.0) initially_active++;
+
+  p->capacity = 16;
+  while (p->capacity < initially_active) p->capacity *= 2;
+  p->active_reactions = calloc(p->capacity, sizeof(int));
+  p->tree = calloc(2 * p->capacity - 1, sizeof(double));
+
+  for (int i = 0; i < number_of_reactions; i++) {
+    if (initial_propensities[i] > 0.0) {
+      int slot = p->number_of_active_reactions++;
+      p->position[i] = slot;
+      p->active_reactions[slot] = i;
+      p->tree[p->capacity - 1 + slot] = initial_propensities[i];
+    }
+    else p->position[i] = -1;
+  }
+
+  for (int parent = p->capacity - 2; parent >= 0; parent--)
+    p->tree[parent] = p->tree[2 * parent + 1] + p->tree[2 * parent + 2];
+
+  p->propensity_sum = p->tree[0];
+
+  return p;
+}
+
+void free_solve_active_set(SolveActiveSet *p) {
+  free_sampler(p->sampler);
+  free(p->position);
+  free(p->active_reactions);
+  free(p->tree);
+  free(p);
+}
+
+void reset_solve_active_set(SolveActiveSet *p, SolveActiveSet *initial) {
+  // the tree is shaped by the capacity, so go back to that of initial
+  if (p->capacity != initial->capacity) {
+    p->capacity = initial->capacity;
+    p->active_reactions = realloc(p->active_reactions,
+                                  p->capacity * sizeof(int));
+    free(p->tree);
+    p->tree = calloc(2 * p->capacity - 1, sizeof(double));
+  }
+
+  memcpy(p->position, initial->position, p->number_of_reactions * sizeof(int));
+  memcpy(p->active_reactions, initial->active_reactions,
+         p->capacity * sizeof(int));
+  memcpy(p->tree, initial->tree, (2 * p->capacity - 1) * sizeof(double));
+  p->number_of_active_reactions = initial->number_of_active_reactions;
+  p->propensity_sum = initial->propensity_sum;
+}
+
+void update_solve_active_set(void *solve_active_setp,
+                             int reaction_to_update,
+                             double new_propensity) {
+  SolveActiveSet *p = (SolveActiveSet *) solve_active_setp;
+  int slot = p->position[reaction_to_update];
+
+  if (slot >= 0 && new_propensity > 0.0)
+    active_set_set_slot(p, slot, new_propensity);
+
+  else if (slot < 0 && new_propensity > 0.0) {
+    // reaction becomes active
+    if (p->number_of_active_reactions == p->capacity)
+      active_set_resize(p, 2 * p->capacity);
+
+    slot = p->number_of_active_reactions++;
+    p->position[reaction_to_update] = slot;
+    p->active_reactions[slot] = reaction_to_update;
+    active_set_set_slot(p, slot, new_propensity);
+  }
+
+  else if (slot >= 0) {
+    // reaction becomes inactive. Move the last active reaction into its slot
+    int last_slot = --p->number_of_active_reactions;
+    int last_reaction = p->active_reactions[last_slot];
+
+    if (last_slot != slot) {
+      p->active_reactions[slot] = last_reaction;
+      p->position[last_reaction] = slot;
+      active_set_set_slot(p, slot, p->tree[p->capacity - 1 + last_slot]);
+    }
+
+    active_set_set_slot(p, last_slot, 0.0);
+    p->position[reaction_to_update] = -1;
+  }
+
+  p->propensity_sum = p->tree[0];
+}
+
+void update_many_solve_active_set(void *solve_active_setp,
+                                  int number_of_updates,
+                                  int *reactions_to_update,
+                                  double *new_propensities) {
+  SolveActiveSet *p = (SolveActiveSet *) solve_active_setp;
+  for (int i = 0; i < number_of_updates; i++)
+    update_solve_active_set(p, reactions_to_update[i], new_propensities[i]);
+}
+
+int event_solve_active_set(void *solve_active_setp, double *dtp) {
+  SolveActiveSet *p = (SolveActiveSet *) solve_active_setp;
+
+  if (p->number_of_active_reactions == 0) {
+    return -1;
+  }
+
+  double r1 = sample_uniform(p->sampler);
+  double exponential = sample_exponential(p->sampler);
+
+  // walk tree from root to appropriate leaf
+  double value = r1 * p->propensity_sum;
+  int i = 0;
+  while (i < p->capacity - 1) {
+    int left_child = 2 * i + 1;
+    if (value <= p->tree[left_child]) i = left_child;
+    else {
+      value -= p->tree[left_child];
+      i = left_child + 1;
+    }
+  }
+
+  // round off can land us just past the last active slot
+  int slot = i - (p->capacity - 1);
+  if (slot >= p->number_of_active_reactions)
+    slot = p->number_of_active_reactions - 1;
+
+  *dtp = exponential / p->propensity_sum;
+  return p->active_reactions[slot];
+}
+
+double get_propensity_solve_active_set(void *solve_active_setp, int reaction) {
+  SolveActiveSet *p = (SolveActiveSet *) solve_active_setp;
+  int slot = p->position[reaction];
+  if (slot < 0) return 0.0;
+  return p->tree[p->capacity - 1 + slot];
+}
+
+double get_propensity_sum_solve_active_set(void *solve_active_setp) {
+  SolveActiveSet *p = (SolveActiveSet *) solve_active_setp;
+  return p->propensity_sum;
+}
+
+int get_number_of_active_reactions_solve_active_set(void *solve_active_setp) {
+  SolveActiveSet *p = (SolveActiveSet *) solve_active_setp;
+  return p->number_of_active_reactions;
+}
+
+
+// sorting linear solver
+
+SolveSortingLinear *new_solve_sorting_linear(SamplerType sampler_type,
+                                             unsigned long int seed,
+                                             int number_of_reactions,
+                                             double *initial_propensities) {
+
+  SolveSortingLinear *p = calloc(1, sizeof(SolveSortingLinear));
+  p->update = &update_solve_sorting_linear;
+  p->update_many = &update_many_solve_sorting_linear;
+  p->event = &event_solve_sorting_linear;
+  p->get_propensity = &get_propensity_solve_sorting_linear;
+  p->get_propensity_sum = &get_propensity_sum_solve_sorting_linear;
+  p->get_number_of_active_reactions =
+    &get_number_of_active_reactions_solve_sorting_linear;
+  p->update_species = NULL;
+  p->type = sorting_linear;
+  p->sampler = new_sampler(sampler_type, seed);
+  p->number_of_reactions = number_of_reactions;
+  p->number_of_active_reactions = 0;
+  p->propensities = calloc(number_of_reactions, sizeof(double));
+  p->order = calloc(number_of_reactions, sizeof(int));
+  p->position = calloc(number_of_reactions, sizeof(int));
+  p->propensity_sum = 0.0;
+
+  // start in reaction order
+  for (int i = 0; i < number_of_reactions; i++) {
+    if (initial_propensities[i] > 0.0) p->number_of_active_reactions++;
+    p->propensities[i] = initial_propensities[i];
+    p->propensity_sum += initial_propensities[i];
+    p->order[i] = i;
+    p->position[i] = i;
+  }
+
+  return p;
+}
+
+void free_solve_sorting_linear(SolveSortingLinear *p) {
+  free_sampler(p->sampler);
+  free(p->propensities);
+  free(p->order);
+  free(p->position);
+  free(p);
+}
+
+void reset_solve_sorting_linear(SolveSortingLinear *p, SolveSortingLinear *initial) {
+  int number_of_reactions = p->number_of_reactions;
+
+  memcpy(p->propensities, initial->propensities,
+         number_of_reactions * sizeof(double));
+  memcpy(p->order, initial->order, number_of_reactions * sizeof(int));
+  memcpy(p->position, initial->position, number_of_reactions * sizeof(int));
+  p->number_of_active_reactions = initial->number_of_active_reactions;
+  p->propensity_sum = initial->propensity_sum;
+}
+
+void update_solve_sorting_linear(void *solve_sorting_linearp,
+                                 int reaction_to_update,
+                                 double new_propensity) {
+  SolveSortingLinear *p = (SolveSortingLinear *) solve_sorting_linearp;
+  int i = p->position[reaction_to_update];
+  if (p->propensities[i] > 0.0) p->number_of_active_reactions--;
+  if (new_propensity > 0.0) p->number_of_active_reactions++;
+  p->propensity_sum -= p->propensities[i];
+  p->propensity_sum += new_propensity;
+  p->propensities[i] = new_propensity;
+}
+
+void update_many_solve_sorting_linear(void *solve_sorting_linearp,
+                                      int number_of_updates,
+                                      int *reactions_to_update,
+                                      double *new_propensities) {
+  SolveSortingLinear *p = (SolveSortingLinear *) solve_sorting_linearp;
+  for (int i = 0; i < number_of_updates; i++)
+    update_solve_sorting_linear(p, reactions_to_update[i], new_propensities[i]);
+}
+
+int event_solve_sorting_linear(void *solve_sorting_linearp, double *dtp) {
+  SolveSortingLinear *p = (SolveSortingLinear *) solve_sorting_linearp;
+  int m;
+
+  if (p->number_of_active_reactions == 0) {
+    p->propensity_sum = 0.0;
+    return -1;
+  }
+
+  double r1 = sample_uniform(p->sampler);
+  double exponential = sample_exponential(p->sampler);
+
+  double fraction = p->propensity_sum * r1;
+  double partial = 0.0;
+
+  for (m = 0; m < p->number_of_reactions; m++) {
+    partial += p->propensities[m];
+    if (partial > fraction) break;
+  }
+
+  // round off can take us past the end, back up to an active reaction
+  if (m == p->number_of_reactions) {
+    m--;
+    while (m > 0 && p->propensities[m] == 0.0) m--;
+  }
+
+  int reaction = p->order[m];
+
+  // move the reaction which fired one step towards the front
+  if (m > 0) {
+    int previous_reaction = p->order[m - 1];
+    double previous_propensity = p->propensities[m - 1];
+
+    p->propensities[m - 1] = p->propensities[m];
+    p->order[m - 1] = reaction;
+    p->position[reaction] = m - 1;
+
+    p->propensities[m] = previous_propensity;
+    p->order[m] = previous_reaction;
+    p->position[previous_reaction] = m;
+  }
+
+  *dtp = exponential / p->propensity_sum;
+  return reaction;
+}
+
+double get_propensity_solve_sorting_linear(void *solve_sorting_linearp, int reaction) {
+  SolveSortingLinear *p = (SolveSortingLinear *) solve_sorting_linearp;
+  return p->propensities[p->position[reaction]];
+}
+
+double get_propensity_sum_solve_sorting_linear(void *solve_sorting_linearp) {
+  SolveSortingLinear *p = (SolveSortingLinear *) solve_sorting_linearp;
+  return p->propensity_sum;
+}
+
+int get_number_of_active_reactions_solve_sorting_linear(void *solve_sorting_linearp) {
+  SolveSortingLinear *p = (SolveSortingLinear *) solve_sorting_linearp;
+  return p->number_of_active_reactions;
+}
+
+
+// partial propensity solver
+
+// partial propensity of a reaction from the current state.
+// propensity = count of first reactant * partial propensity
+static double partial_propensity_of(SolvePartialPropensity *p, int reaction) {
+  ReactionNetwork *reaction_network = p->reaction_network;
+  int *reactants = reaction_network->reactants[reaction];
+
+  switch (reaction_network->number_of_reactants[reaction]) {
+  case 0:
+    return reaction_network->factor_zero * reaction_network->rates[reaction];
+
+  case 1:
+    return reaction_network->rates[reaction];
+
+  default:
+    if (reactants[0] == reactants[1]) {
+      // zero when the count is 0 or 1, whatever the sign of count - 1
+      int count = p->state[reactants[0]];
+      return count > 1 ? reaction_network->factor_duplicate
+        * reaction_network->factor_two
+        * (count - 1)
+        * reaction_network->rates[reaction] : 0.0;
+    }
+    else
+      return reaction_network->factor_two
+        * p->state[reactants[1]]
+        * reaction_network->rates[reaction];
+  }
+}
+
+static inline int partial_propensity_group_count(SolvePartialPropensity *p,
+                                                 int group) {
+  if (group == p->number_of_groups - 1) return 1;
+  return p->state[group];
+}
+
+// recompute the propensity of a group after its count
+// or its partial propensities changed
+static void partial_propensity_refresh_group(SolvePartialPropensity *p,
+                                             int group) {
+  int count = partial_propensity_group_count(p, group);
+
+  int contribution = count > 0 ? p->group_number_of_active[group] : 0;
+  p->number_of_active_reactions +=
+    contribution - p->group_active_contribution[group];
+  p->group_active_contribution[group] = contribution;
+
+  // reset exactly so round off doesn't accumulate
+  if (p->group_number_of_active[group] == 0)
+    p->group_partial_sum[group] = 0.0;
+
+  double new_group_propensity = count > 0 ?
+    count * p->group_partial_sum[group] : 0.0;
+  p->propensity_sum += new_group_propensity - p->group_propensity[group];
+  p->group_propensity[group] = new_group_propensity;
+}
+
+// recompute the partial propensity of reaction without refreshing its group
+static void partial_propensity_set_reaction(SolvePartialPropensity *p,
+                                            int reaction) {
+  int group = p->group_of_reaction[reaction];
+  int position = p->position_of_reaction[reaction];
+  double old_partial = p->partial_propensities[position];
+  double new_partial = partial_propensity_of(p, reaction);
+
+  if (old_partial > 0.0) p->group_number_of_active[group]--;
+  if (new_partial > 0.0) p->group_number_of_active[group]++;
+  p->group_partial_sum[group] += new_partial - old_partial;
+  p->partial_propensities[position] = new_partial;
+}
+
+SolvePartialPropensity *new_solve_partial_propensity(
+  SamplerType sampler_type,
+  unsigned long int seed,
+  ReactionNetwork *reaction_network,
+  int *state) {
+
+  SolvePartialPropensity *p = calloc(1, sizeof(SolvePartialPropensity));
+  p->update = &update_solve_partial_propensity;
+  p->update_many = &update_many_solve_partial_propensity;
+  p->event = &event_solve_partial_propensity;
+  p->get_propensity = &get_propensity_solve_partial_propensity;
+  p->get_propensity_sum = &get_propensity_sum_solve_partial_propensity;
+  p->get_number_of_active_reactions =
+    &get_number_of_active_reactions_solve_partial_propensity;
+  p->update_species = &update_species_solve_partial_propensity;
+  p->type = partial_propensity;
+  p->sampler = new_sampler(sampler_type, seed);
+
+  int number_of_reactions = reaction_network->number_of_reactions;
+  int number_of_species = reaction_network->number_of_species;
+  int reaction, group, s;
+
+  p->number_of_reactions = number_of_reactions;
+  p->number_of_active_reactions = 0;
+  p->reaction_network = reaction_network;
+  p->state = state;
+  p->number_of_groups = number_of_species + 1;
+
+  p->group_offsets = calloc(p->number_of_groups + 1, sizeof(int));
+  p->group_reactions = calloc(number_of_reactions, sizeof(int));
+  p->partial_propensities = calloc(number_of_reactions, sizeof(double));
+  p->group_of_reaction = calloc(number_of_reactions, sizeof(int));
+  p->position_of_reaction = calloc(number_of_reactions, sizeof(int));
+  p->species_dependents_offsets = calloc(number_of_species + 1, sizeof(int));
+  p->group_partial_sum = calloc(p->number_of_groups, sizeof(double));
+  p->group_propensity = calloc(p->number_of_groups, sizeof(double));
+  p->group_number_of_active = calloc(p->number_of_groups, sizeof(int));
+  p->group_active_contribution = calloc(p->number_of_groups, sizeof(int));
+  p->propensity_sum = 0.0;
+
+  // counting pass for both CSR arrays. Offsets are shifted by one
+  // so they can be turned into insertion points below
+  for (reaction = 0; reaction < number_of_reactions; reaction++) {
+    int *reactants = reaction_network->reactants[reaction];
+    switch (reaction_network->number_of_reactants[reaction]) {
+    case 0:
+      group = number_of_species;
+      break;
+
+    case 1:
+      group = reactants[0];
+      break;
+
+    default:
+      group = reactants[0];
+      p->species_dependents_offsets[reactants[1]]++;
+      break;
+    }
+
+    p->group_of_reaction[reaction] = group;
+    p->group_offsets[group + 1]++;
+  }
+
+  for (group = 0; group < p->number_of_groups; group++)
+    p->group_offsets[group + 1] += p->group_offsets[group];
+
+  int number_of_species_dependents = 0;
+  for (s = 0; s < number_of_species; s++) {
+    int count = p->species_dependents_offsets[s];
+    p->species_dependents_offsets[s] = number_of_species_dependents;
+    number_of_species_dependents += count;
+  }
+  p->species_dependents_offsets[number_of_species] = number_of_species_dependents;
+  p->species_dependents = calloc(number_of_species_dependents, sizeof(int));
+
+  // filling pass
+  int *group_fill = calloc(p->number_of_groups, sizeof(int));
+  int *species_fill = calloc(number_of_species, sizeof(int));
+
+  for (reaction = 0; reaction < number_of_reactions; reaction++) {
+    group = p->group_of_reaction[reaction];
+    int position = p->group_offsets[group] + group_fill[group]++;
+    p->group_reactions[position] = reaction;
+    p->position_of_reaction[reaction] = position;
+
+    if (reaction_network->number_of_reactants[reaction] == 2) {
+      s = reaction_network->reactants[reaction][1];
+      p->species_dependents[
+        p->species_dependents_offsets[s] + species_fill[s]++] = reaction;
+    }
+  }
+
+  free(group_fill);
+  free(species_fill);
+
+  for (reaction = 0; reaction < number_of_reactions; reaction++)
+    partial_propensity_set_reaction(p, reaction);
+
+  for (group = 0; group < p->number_of_groups; group++)
+    partial_propensity_refresh_group(p, group);
+
+  return p;
+}
+
+void free_solve_partial_propensity(SolvePartialPropensity *p) {
+  // the reaction network and state belong to the simulation
+  free_sampler(p->sampler);
+  free(p->group_offsets);
+  free(p->group_reactions);
+  free(p->partial_propensities);
+  free(p->group_of_reaction);
+  free(p->position_of_reaction);
+  free(p->species_dependents_offsets);
+  free(p->species_dependents);
+  free(p->group_partial_sum);
+  free(p->group_propensity);
+  free(p->group_number_of_active);
+  free(p->group_active_contribution);
+  free(p);
+}
+
+void reset_solve_partial_propensity(SolvePartialPropensity *p,
+                                    SolvePartialPropensity *initial) {
+  // the groups and their order don't change, only what is computed from
+  // the state. The state itself belongs to the simulation
+  int number_of_groups = p->number_of_groups;
+
+  memcpy(p->partial_propensities, initial->partial_propensities,
+         p->number_of_reactions * sizeof(double));
+  memcpy(p->group_partial_sum, initial->group_partial_sum,
+         number_of_groups * sizeof(double));
+  memcpy(p->group_propensity, initial->group_propensity,
+         number_of_groups * sizeof(double));
+  memcpy(p->group_number_of_active, initial->group_number_of_active,
+         number_of_groups * sizeof(int));
+  memcpy(p->group_active_contribution, initial->group_active_contribution,
+         number_of_groups * sizeof(int));
+  p->number_of_active_reactions = initial->number_of_active_reactions;
+  p->propensity_sum = initial->propensity_sum;
+}
+
+void update_solve_partial_propensity(void *solve_partial_propensityp,
+                                     int reaction_to_update,
+                                     double new_propensity) {
+  SolvePartialPropensity *p = (SolvePartialPropensity *) solve_partial_propensityp;
+  // the partial propensities are recomputed from the state instead
+  (void) new_propensity;
+  partial_propensity_set_reaction(p, reaction_to_update);
+  partial_propensity_refresh_group(p, p->group_of_reaction[reaction_to_update]);
+}
+
+void update_many_solve_partial_propensity(void *solve_partial_propensityp,
+                                          int number_of_updates,
+                                          int *reactions_to_update,
+                                          double *new_propensities) {
+  SolvePartialPropensity *p = (SolvePartialPropensity *) solve_partial_propensityp;
+  for (int i = 0; i < number_of_updates; i++)
+    update_solve_partial_propensity(p, reactions_to_update[i],
+                                    new_propensities[i]);
+}
+
+void update_species_solve_partial_propensity(void *solve_partial_propensityp,
+                                             int number_of_species,
+                                             int *species) {
+  SolvePartialPropensity *p = (SolvePartialPropensity *) solve_partial_propensityp;
+
+  for (int i = 0; i < number_of_species; i++) {
+    int s = species[i];
+
+    for (int j = p->species_dependents_offsets[s];
+         j < p->species_dependents_offsets[s + 1];
+         j++) {
+      int reaction = p->species_dependents[j];
+      partial_propensity_set_reaction(p, reaction);
+      partial_propensity_refresh_group(p, p->group_of_reaction[reaction]);
+    }
+
+    partial_propensity_refresh_group(p, s);
+  }
+}
+
+int event_solve_partial_propensity(void *solve_partial_propensityp, double *dtp) {
+  SolvePartialPropensity *p = (SolvePartialPropensity *) solve_partial_propensityp;
+  int group, selected_group = -1;
+  int i, selected_position = -1;
+
+  if (p->number_of_active_reactions == 0) {
+    p->propensity_sum = 0.0;
+    return -1;
+  }
+
+  double r1 = sample_uniform(p->sampler);
+  double exponential = sample_exponential(p->sampler);
+
+  // pick a group
+  double fraction = p->propensity_sum * r1;
+  double partial = 0.0;
+
+  for (group = 0; group < p->number_of_groups; group++) {
+    if (p->group_active_contribution[group] == 0) continue;
+    selected_group = group;
+    partial += p->group_propensity[group];
+    if (partial > fraction) break;
+  }
+
+  // pick a reaction in the group. What is left of fraction is divided
+  // by the count so it can be compared to partial propensities
+  double remainder = (fraction - (partial - p->group_propensity[selected_group]))
+    / partial_propensity_group_count(p, selected_group);
+  double partial_in_group = 0.0;
+
+  for (i = p->group_offsets[selected_group];
+       i < p->group_offsets[selected_group + 1];
+       i++) {
+    if (p->partial_propensities[i] <= 0.0) continue;
+    selected_position = i;
+    partial_in_group += p->partial_propensities[i];
+    if (partial_in_group > remainder) break;
+  }
+
+  *dtp = exponential / p->propensity_sum;
+  return p->group_reactions[selected_position];
+}
+
+double get_propensity_solve_partial_propensity(void *solve_partial_propensityp,
+                                               int reaction) {
+  SolvePartialPropensity *p = (SolvePartialPropensity *) solve_partial_propensityp;
+  int group = p->group_of_reaction[reaction];
+  int count = partial_propensity_group_count(p, group);
+  if (count <= 0) return 0.0;
+  return count * p->partial_propensities[p->position_of_reaction[reaction]];
+}
+
+double get_propensity_sum_solve_partial_propensity(void *solve_partial_propensityp) {
+  SolvePartialPropensity *p = (SolvePartialPropensity *) solve_partial_propensityp;
+  return p->propensity_sum;
+}
+
+int get_number_of_active_reactions_solve_partial_propensity(
+  void *solve_partial_propensityp) {
+  SolvePartialPropensity *p = (SolvePartialPropensity *) solve_partial_propensityp;
+  return p->number_of_active_reactions;
+}
@@ -1,7 +1,10 @@
 #ifndef SOLVERS_H
 #define SOLVERS_H
 #include "sampler.h"
+#include "reaction_network.h"
 #include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 /***************************************************************************/
@@ -9,15 +12,43 @@
 /* the solver is the algorithmic backbone of a reaction network simulation */
 /* it decides which reaction will occour next.                             */
 /*                                                                         */
-/* for now, we have the linear solver and a tree solver ported from        */
-/* spparks: https://spparks.sandia.gov/                                    */
+/* we have                                                                 */
+/* - the linear solver and a tree solver ported from spparks:              */
+/*   https://spparks.sandia.gov/                                           */
+/* - a composition rejection solver following Slepoy, Thompson and         */
+/*   Plimpton, J. Chem. Phys. 128 (2008)                                   */
+/* - a wide tree solver, the tree solver with 8 way nodes                  */
+/* - the next reaction method of Gibson and Bruck,                         */
+/*   J. Phys. Chem. A 104 (2000)                                           */
+/* - an integer tree solver, the tree solver in fixed point                */
+/* - an active set solver which only stores reactions with nonzero         */
+/*   propensity                                                            */
+/* - a sorting linear solver, the sorting direct method of McCollum et     */
+/*   al., Comput. Biol. Chem. 30 (2006)                                    */
+/* - a partial propensity solver following Ramaswamy, Gonzalez-Segredo     */
+/*   and Sbalzarini, J. Chem. Phys. 130 (2009)                             */
 /***************************************************************************/
 
 typedef enum solveType {
   linear,
   tree,
+  composition_rejection,
+  wide_tree,
+  next_reaction,
+  integer_tree,
+  active_set,
+  sorting_linear,
+  partial_propensity,
 } SolveType;
 
+#define NUMBER_OF_SOLVE_TYPES 9
+
+// names used to select a solver on the command line, indexed by SolveType
+extern char *solve_type_names[NUMBER_OF_SOLVE_TYPES];
+
+// returns -1 if there is no solver with that name
+int solve_type_from_name(char *name);
+
 // General solver API. this allows us to swap out the solver and add new solvers
 typedef struct solveGeneral {
 
@@ -26,6 +57,9 @@ typedef struct solveGeneral {
                  double new_propensity);
 
   // reactions_to_update is a pointer to the indices to update
+  // propensity_buffer[i] is the new propensity of reactions_to_update[i].
+  // Solvers may assume that reactions_to_update is sorted. It still has to
+  // give the correct result if it isn't, just more slowly.
   void (*update_many)(void *p,
                      int number_of_updates,
                      int *reactions_to_update,
@@ -39,17 +73,49 @@ typedef struct solveGeneral {
 
   int (*get_number_of_active_reactions)(void *p);
 
+  // NULL unless the solver reads species counts itself. In that case,
+  // after a reaction fires, it is passed the species whose counts changed
+  // (possibly with repeats) instead of the propensities of the dependents
+  void (*update_species)(void *p,
+                         int number_of_species,
+                         int *species);
+
   SolveType type;
 
+  // every solver stores its sampler directly after type
+  Sampler *sampler;
+
 } Solve;
 
+// state is the species counts of the simulation the solver belongs to.
+// Only solvers with update_species keep a reference to it
 Solve *new_solve(SolveType type,
+                SamplerType sampler_type,
                 unsigned long int seed,
-                int number_of_reactions,
-                double *initial_propensities);
+                ReactionNetwork *reaction_network,
+                int *state);
 
 void free_solve(Solve *p);
 
+// put p back in the state of initial, a solver of the same type for the
+// same network which has never been updated, and reseed its sampler.
+// Copies the arrays of initial instead of building them again, so running
+// many seeds doesn't allocate or rebuild a solver for each of them
+void reset_solve(Solve *p, Solve *initial, unsigned long int seed);
+
+// reset_solve for a solver which has only been passed the reactions in
+// dirty (without repeats) since initial's state. Only those are
+// restored, initial_propensities[i] being the initial propensity of
+// dirty[i], so the cost follows the length of the trajectory instead of
+// the size of the network. Returns false without changing anything if
+// the solver can't be reset this way, and then reset_solve has to be used
+bool reset_dirty_solve(Solve *p,
+                       Solve *initial,
+                       unsigned long int seed,
+                       int number_of_dirty,
+                       int *dirty,
+                       double *initial_propensities);
+
 
 // linear solver
 
@@ -73,6 +139,10 @@ typedef struct solveLinear {
 
   int (*get_number_of_active_reactions)(void *solve_linearp);
 
+  void (*update_species)(void *solve_linearp,
+                         int number_of_species,
+                         int *species);
+
   SolveType type;
 
   // internal state
@@ -84,11 +154,13 @@ typedef struct solveLinear {
 
 } SolveLinear;
 
-SolveLinear *new_solve_linear(unsigned long int seed,
+SolveLinear *new_solve_linear(SamplerType sampler_type,
+                              unsigned long int seed,
                               int number_of_reactions,
                               double *initial_propensities);
 
 void free_solve_linear(SolveLinear *p);
+void reset_solve_linear(SolveLinear *p, SolveLinear *initial);
 
 void update_solve_linear(void *solve_linearp,
                          int reaction_to_update,
@@ -127,6 +199,10 @@ typedef struct solveTree {
 
   int (*get_number_of_active_reactions)(void *solve_treep);
 
+  void (*update_species)(void *solve_treep,
+                         int number_of_species,
+                         int *species);
+
   SolveType type;
 
   // internal state
@@ -137,14 +213,17 @@ typedef struct solveTree {
   int propensity_offset; // index where propensities start as leaves of tree
   double *tree;  // propensities stored as a binary heap
   double propensity_sum;
+  int *dirty; // scratch space for the ancestors refreshed by update_many
 } SolveTree;
 
 
-SolveTree *new_solve_tree(unsigned long int seed,
+SolveTree *new_solve_tree(SamplerType sampler_type,
+                          unsigned long int seed,
                         int number_of_reactions,
                         double *initial_propensities);
 
 void free_solve_tree(SolveTree *p);
+void reset_solve_tree(SolveTree *p, SolveTree *initial);
 
 void sum_solve_tree(SolveTree *p);
 int find_solve_tree(SolveTree *p, double value);
@@ -164,4 +243,545 @@ double get_propensity_solve_tree(void *solve_treep, int reaction);
 double get_propensity_sum_solve_tree(void *solve_treep);
 int get_number_of_active_reactions_solve_tree(void *solve_treep);
 
+// composition rejection solver
+// reactions are grouped by propensity into buckets [2^(e-1), 2^e).
+// a group is chosen by scanning the (few) nonempty groups, then a
+// reaction is chosen within the group by rejection sampling, which
+// accepts with probability at least 1/2. Both selection and update
+// are O(1) in the number of reactions.
+
+// frexp exponents of positive doubles lie in [-1073, 1024]
+#define COMPOSITION_REJECTION_MIN_EXPONENT -1073
+#define COMPOSITION_REJECTION_NUMBER_OF_GROUPS 2098
+
+typedef struct compositionGroup {
+  int *reactions; // reactions currently in the group
+  int number_of_reactions;
+  int capacity;
+  double propensity_sum;
+  double max_propensity; // upper bound 2^e for propensities in the group
+} CompositionGroup;
+
+typedef struct solveComposition {
+
+  // API
+  void (*update)(void *solve_compositionp,
+                 int reaction_to_update,
+                 double new_propensity);
+
+  void (*update_many)(void *solve_compositionp,
+                     int number_of_updates,
+                     int *reactions_to_update,
+                     double *propensity_buffer);
+
+  int (*event)(void *solve_compositionp, double *dtp);
+
+  double (*get_propensity)(void *solve_compositionp, int reaction);
+
+  double (*get_propensity_sum)(void *solve_compositionp);
+
+  int (*get_number_of_active_reactions)(void *solve_compositionp);
+
+  void (*update_species)(void *solve_compositionp,
+                         int number_of_species,
+                         int *species);
+
+  SolveType type;
+
+  // internal state
+  Sampler *sampler;
+  int number_of_reactions;
+  int number_of_active_reactions;
+  double *propensities;
+  int *group_of_reaction; // -1 if the reaction has zero propensity
+  int *position_in_group; // index into groups[group_of_reaction].reactions
+  CompositionGroup *groups;
+  int min_group; // range of groups which may be nonempty
+  int max_group;
+  double propensity_sum;
+} SolveComposition;
+
+SolveComposition *new_solve_composition(SamplerType sampler_type,
+                                        unsigned long int seed,
+                                        int number_of_reactions,
+                                        double *initial_propensities);
+
+void free_solve_composition(SolveComposition *p);
+void reset_solve_composition(SolveComposition *p, SolveComposition *initial);
+
+void update_solve_composition(void *solve_compositionp,
+                              int reaction_to_update,
+                              double new_propensity);
+
+void update_many_solve_composition(void *solve_compositionp,
+                                   int number_of_updates,
+                                   int *reactions_to_update,
+                                   double *propensity_buffer);
+
+int event_solve_composition(void *solve_compositionp, double *dtp);
+
+double get_propensity_solve_composition(void *solve_compositionp, int reaction);
+double get_propensity_sum_solve_composition(void *solve_compositionp);
+int get_number_of_active_reactions_solve_composition(void *solve_compositionp);
+
+// wide tree solver
+// same idea as the tree solver, but every node has WIDE_TREE_ARITY
+// children which are stored contiguously in one cache line. Finding a
+// reaction or propagating an update touches one cache line per level
+// and there are a third as many levels as in the binary tree.
+
+#define WIDE_TREE_ARITY 8
+#define WIDE_TREE_MAX_DEPTH 12
+
+typedef struct solveWideTree {
+
+  // API
+  void (*update)(void *solve_wide_treep,
+                 int reaction_to_update,
+                 double new_propensity);
+
+  void (*update_many)(void *solve_wide_treep,
+                     int number_of_updates,
+                     int *reactions_to_update,
+                     double *propensity_buffer);
+
+  int (*event)(void *solve_wide_treep, double *dtp);
+
+  double (*get_propensity)(void *solve_wide_treep, int reaction);
+
+  double (*get_propensity_sum)(void *solve_wide_treep);
+
+  int (*get_number_of_active_reactions)(void *solve_wide_treep);
+
+  void (*update_species)(void *solve_wide_treep,
+                         int number_of_species,
+                         int *species);
+
+  SolveType type;
+
+  // internal state
+  Sampler *sampler;
+  int number_of_reactions;
+  int number_of_active_reactions;
+  int depth; // number of levels. Level 0 is the root, level depth - 1 the leaves
+  // index into tree where each level starts. Always a multiple of
+  // WIDE_TREE_ARITY, so the children of a node are aligned to a cache line
+  int level_offset[WIDE_TREE_MAX_DEPTH];
+  int number_of_tree_nodes;
+  double *tree; // children of node k on level d are nodes
+                // WIDE_TREE_ARITY * k, ..., WIDE_TREE_ARITY * k + 7 on level d + 1
+  double propensity_sum;
+  int *dirty; // scratch space for the ancestors refreshed by update_many
+} SolveWideTree;
+
+SolveWideTree *new_solve_wide_tree(SamplerType sampler_type,
+                                   unsigned long int seed,
+                                   int number_of_reactions,
+                                   double *initial_propensities);
+
+void free_solve_wide_tree(SolveWideTree *p);
+void reset_solve_wide_tree(SolveWideTree *p, SolveWideTree *initial);
+
+void sum_solve_wide_tree(SolveWideTree *p);
+int find_solve_wide_tree(SolveWideTree *p, double value);
+
+void update_solve_wide_tree(void *solve_wide_treep,
+                            int reaction_to_update,
+                            double new_propensity);
+
+void update_many_solve_wide_tree(void *solve_wide_treep,
+                                 int number_of_updates,
+                                 int *reactions_to_update,
+                                 double *propensity_buffer);
+
+int event_solve_wide_tree(void *solve_wide_treep, double *dtp);
+
+double get_propensity_solve_wide_tree(void *solve_wide_treep, int reaction);
+double get_propensity_sum_solve_wide_tree(void *solve_wide_treep);
+int get_number_of_active_reactions_solve_wide_tree(void *solve_wide_treep);
+
+// next reaction solver
+// every reaction has a putative absolute firing time, and the reactions
+// are stored in a binary heap ordered by firing time, so the next reaction
+// is always at the root. When a propensity changes, the remaining waiting
+// time is rescaled by old_propensity / new_propensity, which only needs
+// a random number for the reaction which just fired. The heap position of
+// each reaction is tracked so updates are O(log R).
+
+typedef struct solveNextReaction {
+
+  // API
+  void (*update)(void *solve_next_reactionp,
+                 int reaction_to_update,
+                 double new_propensity);
+
+  void (*update_many)(void *solve_next_reactionp,
+                     int number_of_updates,
+                     int *reactions_to_update,
+                     double *propensity_buffer);
+
+  int (*event)(void *solve_next_reactionp, double *dtp);
+
+  double (*get_propensity)(void *solve_next_reactionp, int reaction);
+
+  double (*get_propensity_sum)(void *solve_next_reactionp);
+
+  int (*get_number_of_active_reactions)(void *solve_next_reactionp);
+
+  void (*update_species)(void *solve_next_reactionp,
+                         int number_of_species,
+                         int *species);
+
+  SolveType type;
+
+  // internal state
+  Sampler *sampler;
+  int number_of_reactions;
+  int number_of_active_reactions;
+  double *propensities;
+  double *firing_times; // INFINITY for reactions with zero propensity
+  int *heap; // reactions ordered as a binary heap by firing time
+  int *heap_position; // index of each reaction in heap
+  double time; // firing time of the last reaction
+  int last_fired; // -1 once the last reaction has a new firing time
+  double propensity_sum;
+} SolveNextReaction;
+
+SolveNextReaction *new_solve_next_reaction(SamplerType sampler_type,
+                                           unsigned long int seed,
+                                           int number_of_reactions,
+                                           double *initial_propensities);
+
+void free_solve_next_reaction(SolveNextReaction *p);
+// the firing times are drawn again, so reseed the sampler first
+void reset_solve_next_reaction(SolveNextReaction *p, SolveNextReaction *initial);
+
+void update_solve_next_reaction(void *solve_next_reactionp,
+                                int reaction_to_update,
+                                double new_propensity);
+
+void update_many_solve_next_reaction(void *solve_next_reactionp,
+                                     int number_of_updates,
+                                     int *reactions_to_update,
+                                     double *propensity_buffer);
+
+int event_solve_next_reaction(void *solve_next_reactionp, double *dtp);
+
+double get_propensity_solve_next_reaction(void *solve_next_reactionp, int reaction);
+double get_propensity_sum_solve_next_reaction(void *solve_next_reactionp);
+int get_number_of_active_reactions_solve_next_reaction(void *solve_next_reactionp);
+
+// integer tree solver
+// the tree solver, but the tree stores propensities scaled by a power of
+// two and rounded to 64 bit integers. Integer sums are exact, so interior
+// nodes never drift from the sum of their leaves however many updates they
+// see, and the root is the exact total used for selection. Nonzero
+// propensities round to at least 1 so active reactions can always fire.
+// The scale is chosen so the total sits around 2^INTEGER_TREE_TARGET_BITS,
+// leaving room for the total to grow by a factor of 2^16 before the tree
+// is rescaled from the exact double propensities.
+
+#define INTEGER_TREE_TARGET_BITS 46
+#define INTEGER_TREE_MAX_BITS 62
+#define INTEGER_TREE_MIN_BITS 30
+
+typedef struct solveIntegerTree {
+
+  // API
+  void (*update)(void *solve_integer_treep,
+                 int reaction_to_update,
+                 double new_propensity);
+
+  void (*update_many)(void *solve_integer_treep,
+                     int number_of_updates,
+                     int *reactions_to_update,
+                     double *propensity_buffer);
+
+  int (*event)(void *solve_integer_treep, double *dtp);
+
+  double (*get_propensity)(void *solve_integer_treep, int reaction);
+
+  double (*get_propensity_sum)(void *solve_integer_treep);
+
+  int (*get_number_of_active_reactions)(void *solve_integer_treep);
+
+  void (*update_species)(void *solve_integer_treep,
+                         int number_of_species,
+                         int *species);
+
+  SolveType type;
+
+  // internal state
+  Sampler *sampler;
+  int number_of_reactions;
+  int number_of_active_reactions;
+  int number_of_tree_nodes;
+  int propensity_offset; // index where propensities start as leaves of tree
+  uint64_t *tree; // scaled propensities stored as a binary heap
+  double *propensities; // unscaled propensities
+  double scale; // tree leaves are propensities * scale, rounded
+  double propensity_sum; // tree[0] / scale
+  int *dirty; // scratch space for the ancestors refreshed by update_many
+} SolveIntegerTree;
+
+SolveIntegerTree *new_solve_integer_tree(SamplerType sampler_type,
+                                         unsigned long int seed,
+                                         int number_of_reactions,
+                                         double *initial_propensities);
+
+void free_solve_integer_tree(SolveIntegerTree *p);
+void reset_solve_integer_tree(SolveIntegerTree *p, SolveIntegerTree *initial);
+
+// recompute the scale and the whole tree from the unscaled propensities
+void rescale_solve_integer_tree(SolveIntegerTree *p);
+int find_solve_integer_tree(SolveIntegerTree *p, uint64_t value);
+
+void update_solve_integer_tree(void *solve_integer_treep,
+                               int reaction_to_update,
+                               double new_propensity);
+
+void update_many_solve_integer_tree(void *solve_integer_treep,
+                                    int number_of_updates,
+                                    int *reactions_to_update,
+                                    double *propensity_buffer);
+
+int event_solve_integer_tree(void *solve_integer_treep, double *dtp);
+
+double get_propensity_solve_integer_tree(void *solve_integer_treep, int reaction);
+double get_propensity_sum_solve_integer_tree(void *solve_integer_treep);
+int get_number_of_active_reactions_solve_integer_tree(void *solve_integer_treep);
+
+// active set solver
+// a tree solver over the reactions with nonzero propensity only. The
+// active reactions are kept in a dense array (removal swaps the last
+// active reaction into the hole) and a position map takes a reaction to
+// its slot. The tree has a leaf per slot and doubles in size when it
+// fills up. When few reactions are active, this uses much less memory
+// than the tree solver and the tree is much shallower.
+
+typedef struct solveActiveSet {
+
+  // API
+  void (*update)(void *solve_active_setp,
+                 int reaction_to_update,
+                 double new_propensity);
+
+  void (*update_many)(void *solve_active_setp,
+                     int number_of_updates,
+                     int *reactions_to_update,
+                     double *propensity_buffer);
+
+  int (*event)(void *solve_active_setp, double *dtp);
+
+  double (*get_propensity)(void *solve_active_setp, int reaction);
+
+  double (*get_propensity_sum)(void *solve_active_setp);
+
+  int (*get_number_of_active_reactions)(void *solve_active_setp);
+
+  void (*update_species)(void *solve_active_setp,
+                         int number_of_species,
+                         int *species);
+
+  SolveType type;
+
+  // internal state
+  Sampler *sampler;
+  int number_of_reactions;
+  int number_of_active_reactions;
+  int *position; // slot of each reaction, -1 if it is not active
+  int *active_reactions; // reaction in each slot
+  int capacity; // number of slots, a power of 2
+  double *tree; // binary heap with a leaf per slot
+  double propensity_sum;
+} SolveActiveSet;
+
+SolveActiveSet *new_solve_active_set(SamplerType sampler_type,
+                                     unsigned long int seed,
+                                     int number_of_reactions,
+                                     double *initial_propensities);
+
+void free_solve_active_set(SolveActiveSet *p);
+void reset_solve_active_set(SolveActiveSet *p, SolveActiveSet *initial);
+
+void update_solve_active_set(void *solve_active_setp,
+                             int reaction_to_update,
+                             double new_propensity);
+
+void update_many_solve_active_set(void *solve_active_setp,
+                                  int number_of_updates,
+                                  int *reactions_to_update,
+                                  double *propensity_buffer);
+
+int event_solve_active_set(void *solve_active_setp, double *dtp);
+
+double get_propensity_solve_active_set(void *solve_active_setp, int reaction);
+double get_propensity_sum_solve_active_set(void *solve_active_setp);
+int get_number_of_active_reactions_solve_active_set(void *solve_active_setp);
+
+// sorting linear solver
+// the linear solver, but reactions are scanned in an order which adapts
+// to how often they fire: each time a reaction fires it swaps places with
+// the reaction in front of it. Frequently firing reactions bubble to the
+// front, so on skewed networks the expected scan length is short.
+// reaction ids passed in and out of the API are unchanged.
+
+typedef struct solveSortingLinear {
+
+  // API
+  void (*update)(void *solve_sorting_linearp,
+                 int reaction_to_update,
+                 double new_propensity);
+
+  void (*update_many)(void *solve_sorting_linearp,
+                     int number_of_updates,
+                     int *reactions_to_update,
+                     double *propensity_buffer);
+
+  int (*event)(void *solve_sorting_linearp, double *dtp);
+
+  double (*get_propensity)(void *solve_sorting_linearp, int reaction);
+
+  double (*get_propensity_sum)(void *solve_sorting_linearp);
+
+  int (*get_number_of_active_reactions)(void *solve_sorting_linearp);
+
+  void (*update_species)(void *solve_sorting_linearp,
+                         int number_of_species,
+                         int *species);
+
+  SolveType type;
+
+  // internal state
+  Sampler *sampler;
+  int number_of_reactions;
+  int number_of_active_reactions;
+  double *propensities; // propensities in search order
+  int *order; // reaction at each search position
+  int *position; // search position of each reaction
+  double propensity_sum;
+} SolveSortingLinear;
+
+SolveSortingLinear *new_solve_sorting_linear(SamplerType sampler_type,
+                                             unsigned long int seed,
+                                             int number_of_reactions,
+                                             double *initial_propensities);
+
+void free_solve_sorting_linear(SolveSortingLinear *p);
+void reset_solve_sorting_linear(SolveSortingLinear *p, SolveSortingLinear *initial);
+
+void update_solve_sorting_linear(void *solve_sorting_linearp,
+                                 int reaction_to_update,
+                                 double new_propensity);
+
+void update_many_solve_sorting_linear(void *solve_sorting_linearp,
+                                      int number_of_updates,
+                                      int *reactions_to_update,
+                                      double *propensity_buffer);
+
+int event_solve_sorting_linear(void *solve_sorting_linearp, double *dtp);
+
+double get_propensity_solve_sorting_linear(void *solve_sorting_linearp, int reaction);
+double get_propensity_sum_solve_sorting_linear(void *solve_sorting_linearp);
+int get_number_of_active_reactions_solve_sorting_linear(void *solve_sorting_linearp);
+
+// partial propensity solver
+// every reaction is put in the group of its first reactant (reactions
+// without reactants get their own group) and stores the partial
+// propensity propensity / count of first reactant, which only depends on
+// the second reactant. The propensity of a group is count * sum of its
+// partial propensities. When the count of a species changes, only the
+// partial propensities of reactions where it is the second reactant and
+// the propensity of its own group change, instead of every reaction that
+// consumes it. Selection scans the groups, then the reactions of a group.
+// The solver reads the species counts of the simulation directly, so
+// update, update_many and update_species recompute from the state and
+// ignore any propensities passed in.
+
+typedef struct solvePartialPropensity {
+
+  // API
+  void (*update)(void *solve_partial_propensityp,
+                 int reaction_to_update,
+                 double new_propensity);
+
+  void (*update_many)(void *solve_partial_propensityp,
+                     int number_of_updates,
+                     int *reactions_to_update,
+                     double *propensity_buffer);
+
+  int (*event)(void *solve_partial_propensityp, double *dtp);
+
+  double (*get_propensity)(void *solve_partial_propensityp, int reaction);
+
+  double (*get_propensity_sum)(void *solve_partial_propensityp);
+
+  int (*get_number_of_active_reactions)(void *solve_partial_propensityp);
+
+  void (*update_species)(void *solve_partial_propensityp,
+                         int number_of_species,
+                         int *species);
+
+  SolveType type;
+
+  // internal state
+  Sampler *sampler;
+  int number_of_reactions;
+  int number_of_active_reactions;
+  ReactionNetwork *reaction_network;
+  int *state;
+  int number_of_groups; // number_of_species + 1. The last group has no reactant
+
+  // reactions of group g are group_reactions[group_offsets[g]],...,
+  // group_reactions[group_offsets[g + 1] - 1]
+  int *group_offsets;
+  int *group_reactions;
+  double *partial_propensities; // in the same order as group_reactions
+  int *group_of_reaction;
+  int *position_of_reaction; // index into group_reactions
+
+  // reactions whose partial propensity depends on species s are
+  // species_dependents[species_dependents_offsets[s]], ...
+  int *species_dependents_offsets;
+  int *species_dependents;
+
+  double *group_partial_sum; // sum of partial propensities of each group
+  double *group_propensity; // count * group_partial_sum
+  // number of reactions in each group with nonzero partial propensity
+  int *group_number_of_active;
+  // how much each group currently contributes to number_of_active_reactions
+  int *group_active_contribution;
+  double propensity_sum;
+} SolvePartialPropensity;
+
+SolvePartialPropensity *new_solve_partial_propensity(
+  SamplerType sampler_type,
+  unsigned long int seed,
+  ReactionNetwork *reaction_network,
+  int *state);
+
+void free_solve_partial_propensity(SolvePartialPropensity *p);
+void reset_solve_partial_propensity(SolvePartialPropensity *p, SolvePartialPropensity *initial);
+
+void update_solve_partial_propensity(void *solve_partial_propensityp,
+                                     int reaction_to_update,
+                                     double new_propensity);
+
+void update_many_solve_partial_propensity(void *solve_partial_propensityp,
+                                          int number_of_updates,
+                                          int *reactions_to_update,
+                                          double *propensity_buffer);
+
+void update_species_solve_partial_propensity(void *solve_partial_propensityp,
+                                             int number_of_species,
+                                             int *species);
+
+int event_solve_partial_propensity(void *solve_partial_propensityp, double *dtp);
+
+double get_propensity_solve_partial_propensity(void *solve_partial_propensityp,
+                                               int reaction);
+double get_propensity_sum_solve_partial_propensity(void *solve_partial_propensityp);
+int get_number_of_active_reactions_solve_partial_propensity(
+  void *solve_partial_propensityp);
+
 #endif
@@ -0,0 +1,258 @@
+#include "tau_leaping.h"
+
+// adds delta to the change of species, inserting it if it isn't there yet
+static void add_change(int *species, int *change, int *length,
+                       int species_id, int delta) {
+    for (int i = 0; i < *length; i++) {
+        if (species[i] == species_id) {
+            change[i] += delta;
+            return;
+        }
+    }
+
+    species[*length] = species_id;
+    change[*length] = delta;
+    (*length)++;
+}
+
+// net change in species counts caused by one firing of reaction.
+// species and change need room for 4 entries. Returns the number of
+// species whose count changes, so catalysts (A + B -> A + C) are dropped
+static int net_stoichiometry(ReactionNetwork *reaction_network,
+                             int reaction,
+                             int *species,
+                             int *change) {
+    int length = 0;
+    int m, i, j;
+
+    for (m = 0; m < reaction_network->number_of_reactants[reaction]; m++)
+        add_change(species, change, &length,
+                   reaction_network->reactants[reaction][m], -1);
+
+    for (m = 0; m < reaction_network->number_of_products[reaction]; m++)
+        add_change(species, change, &length,
+                   reaction_network->products[reaction][m], 1);
+
+    j = 0;
+    for (i = 0; i < length; i++) {
+        if (change[i] != 0) {
+            species[j] = species[i];
+            change[j] = change[i];
+            j++;
+        }
+    }
+
+    return j;
+}
+
+// fire reaction count times in state
+static void apply_firings(ReactionNetwork *reaction_network,
+                          int *state,
+                          int reaction,
+                          int count) {
+    int species[4], change[4];
+    int length = net_stoichiometry(reaction_network, reaction, species, change);
+    for (int i = 0; i < length; i++)
+        state[species[i]] += change[i] * count;
+}
+
+void run_for_tau_leaping(Simulation *simulation, int step_cutoff) {
+    ReactionNetwork *reaction_network = simulation->reaction_network;
+    Solve *solver = simulation->solver;
+    int number_of_reactions = reaction_network->number_of_reactions;
+    int number_of_species = reaction_network->number_of_species;
+    int species[4], change[4];
+    int i, j, k, length;
+
+    // highest order of a reaction consuming each species (0 if it is never
+    // consumed) and whether that reaction consumes two of them
+    uint8_t *highest_order = calloc(number_of_species, sizeof(uint8_t));
+    bool *highest_order_duplicate = calloc(number_of_species, sizeof(bool));
+
+    bool *critical = calloc(number_of_reactions, sizeof(bool));
+    int *firings = calloc(number_of_reactions, sizeof(int));
+    double *mu = calloc(number_of_species, sizeof(double));
+    double *sigma_squared = calloc(number_of_species, sizeof(double));
+    int *trial_state = calloc(number_of_species, sizeof(int));
+
+    for (j = 0; j < number_of_reactions; j++) {
+        uint8_t order = reaction_network->number_of_reactants[j];
+        bool duplicate = order == 2 &&
+            reaction_network->reactants[j][0] == reaction_network->reactants[j][1];
+
+        for (k = 0; k < order; k++) {
+            int s = reaction_network->reactants[j][k];
+            if (order > highest_order[s]) highest_order[s] = order;
+            if (duplicate) highest_order_duplicate[s] = true;
+        }
+    }
+
+    while (simulation->step <= step_cutoff) {
+        double propensity_sum = 0.0;
+        double critical_propensity_sum = 0.0;
+
+        // classify reactions and accumulate the mean and variance of the
+        // change of each species due to the non critical reactions
+        for (j = 0; j < number_of_reactions; j++) {
+            double propensity = solver->get_propensity(solver, j);
+            critical[j] = false;
+            if (propensity <= 0.0) continue;
+
+            propensity_sum += propensity;
+            length = net_stoichiometry(reaction_network, j, species, change);
+
+            for (k = 0; k < length; k++)
+                if (change[k] < 0 &&
+                    simulation->state[species[k]] / (- change[k])
+                    < TAU_LEAPING_CRITICAL_THRESHOLD)
+                    critical[j] = true;
+
+            if (critical[j])
+                critical_propensity_sum += propensity;
+            else
+                for (k = 0; k < length; k++) {
+                    mu[species[k]] += change[k] * propensity;
+                    sigma_squared[species[k]] +=
+                        change[k] * change[k] * propensity;
+                }
+        }
+
+        // no reactions can fire
+        if (propensity_sum == 0.0) break;
+
+        // largest leap keeping the relative change of every propensity
+        // below TAU_LEAPING_EPSILON
+        double tau_non_critical = INFINITY;
+        for (i = 0; i < number_of_species; i++) {
+            if (highest_order[i] > 0 &&
+                (mu[i] != 0.0 || sigma_squared[i] != 0.0)) {
+                double x = simulation->state[i];
+                double g = highest_order[i];
+                if (highest_order[i] == 2 && highest_order_duplicate[i] && x > 1.0)
+                    g = 2.0 + 1.0 / (x - 1.0);
+
+                double bound = fmax(TAU_LEAPING_EPSILON * x / g, 1.0);
+                if (mu[i] != 0.0)
+                    tau_non_critical = fmin(tau_non_critical, bound / fabs(mu[i]));
+                if (sigma_squared[i] > 0.0)
+                    tau_non_critical = fmin(tau_non_critical,
+                                            bound * bound / sigma_squared[i]);
+            }
+
+            mu[i] = 0.0;
+            sigma_squared[i] = 0.0;
+        }
+
+        // leaping doesn't pay off, take some exact steps instead. If the
+        // non critical reactions don't constrain tau and there are no critical
+        // reactions, there is nothing bounding the leap, so do the same.
+        if (tau_non_critical < TAU_LEAPING_SSA_FACTOR / propensity_sum ||
+            (isinf(tau_non_critical) && critical_propensity_sum == 0.0)) {
+
+            bool dead_end = false;
+            for (i = 0; i < TAU_LEAPING_SSA_STEPS && ! dead_end; i++) {
+                dead_end = step(simulation);
+                if (simulation->step > step_cutoff) break;
+            }
+
+            if (dead_end) break;
+            continue;
+        }
+
+        double tau;
+        int critical_reaction;
+        bool negative_state;
+
+        do {
+            // time until the next critical reaction
+            double tau_critical = INFINITY;
+            if (critical_propensity_sum > 0.0)
+                tau_critical = sample_exponential(solver->sampler)
+                    / critical_propensity_sum;
+
+            critical_reaction = -1;
+            if (tau_non_critical < tau_critical)
+                tau = tau_non_critical;
+            else {
+                tau = tau_critical;
+
+                // exactly one critical reaction fires
+                double fraction = critical_propensity_sum
+                    * sample_uniform(solver->sampler);
+                double partial = 0.0;
+                for (j = 0; j < number_of_reactions; j++) {
+                    if (! critical[j]) continue;
+                    critical_reaction = j;
+                    partial += solver->get_propensity(solver, j);
+                    if (partial > fraction) break;
+                }
+            }
+
+            for (i = 0; i < number_of_species; i++)
+                trial_state[i] = simulation->state[i];
+
+            for (j = 0; j < number_of_reactions; j++) {
+                double propensity = solver->get_propensity(solver, j);
+                firings[j] = 0;
+
+                if (propensity > 0.0 && ! critical[j])
+                    firings[j] = sample_poisson(solver->sampler, propensity * tau);
+
+                if (j == critical_reaction)
+                    firings[j] = 1;
+
+                if (firings[j] > 0)
+                    apply_firings(reaction_network, trial_state, j, firings[j]);
+            }
+
+            negative_state = false;
+            for (i = 0; i < number_of_species; i++)
+                if (trial_state[i] < 0) negative_state = true;
+
+            // leap was too large, try again with half of it
+            if (negative_state) tau_non_critical /= 2.0;
+
+        } while (negative_state);
+
+        // accept the leap
+        for (i = 0; i < number_of_species; i++)
+            simulation->state[i] = trial_state[i];
+
+        simulation->time += tau;
+
+        for (j = 0; j < number_of_reactions; j++) {
+            if (firings[j] > 0) {
+                insert_history_element(
+                    simulation->history,
+                    j,
+                    firings[j],
+                    simulation->time);
+
+                simulation->step += firings[j];
+            }
+        }
+
+        // the state changed everywhere, so recompute every propensity
+        mark_simulation_dirty(simulation);
+        compute_propensities(
+            reaction_network,
+            simulation->state,
+            number_of_reactions,
+            reaction_network->all_reactions,
+            simulation->propensity_buffer);
+
+        solver->update_many(
+            solver,
+            number_of_reactions,
+            reaction_network->all_reactions,
+            simulation->propensity_buffer);
+    }
+
+    free(highest_order);
+    free(highest_order_duplicate);
+    free(critical);
+    free(firings);
+    free(mu);
+    free(sigma_squared);
+    free(trial_state);
+}
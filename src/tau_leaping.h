@@ -0,0 +1,31 @@
+#ifndef TAU_LEAPING_H
+#define TAU_LEAPING_H
+
+#include "simulation.h"
+
+/***************************************************************************/
+/* approximate simulation by tau leaping                                   */
+/* instead of firing one reaction at a time, every reaction fires a        */
+/* poisson distributed number of times in a leap of length tau. The leap   */
+/* size is chosen following Cao, Gillespie and Petzold,                    */
+/* J. Chem. Phys. 124 (2006), so that no propensity changes by more than   */
+/* roughly TAU_LEAPING_EPSILON over a leap. Reactions which are within     */
+/* TAU_LEAPING_CRITICAL_THRESHOLD firings of exhausting a reactant are     */
+/* critical and fire at most once per leap. When the leap would be too     */
+/* short to pay off, we fall back to exact steps.                          */
+/***************************************************************************/
+
+#define TAU_LEAPING_EPSILON 0.03
+#define TAU_LEAPING_CRITICAL_THRESHOLD 10
+
+// if tau is less than TAU_LEAPING_SSA_FACTOR / propensity_sum, take
+// TAU_LEAPING_SSA_STEPS exact steps instead of leaping
+#define TAU_LEAPING_SSA_FACTOR 10.0
+#define TAU_LEAPING_SSA_STEPS 100
+
+// same contract as run_for: runs until more than step_cutoff reactions
+// have fired or there are no more reactions that can fire.
+// the solver of the simulation is kept in sync with the state.
+void run_for_tau_leaping(Simulation *simulation, int step_cutoff);
+
+#endif
@@ -22,4 +22,99 @@ fi
 rm ./test_materials/initial_state_copy.sqlite
 rm ./test_materials/trajectories
 rm ./test_materials/copy_trajectories
+
+
+# a propensity jumping by many orders of magnitude: reaction 1 (B -> C,
+# rate 1e15) can only fire once reaction 0 (A -> B) has, and then it
+# should always fire before the slow reaction 2 (D -> E). Reaction 3
+# (F -> G) can never fire. The integer tree solver must rescale instead of
+# quantizing 1e15 with the current scale.
+#
+# reduction and renumbering change the internal reaction ids, so the
+# network is also run with both, and with reaction 4 a duplicate of
+# reaction 1 which reduction merges into it. Trajectories must still
+# have database ids: reaction 0 followed by reaction 1 (or its duplicate)
+
+jump_network() {
+    rm -f ./test_materials/jump_rn.sqlite ./test_materials/jump_initial_state.sqlite
+
+    sqlite3 ./test_materials/jump_rn.sqlite "
+    CREATE TABLE metadata (
+        number_of_species   INTEGER NOT NULL,
+        number_of_reactions INTEGER NOT NULL);
+    CREATE TABLE reactions (
+        reaction_id         INTEGER NOT NULL PRIMARY KEY,
+        number_of_reactants INTEGER NOT NULL,
+        number_of_products  INTEGER NOT NULL,
+        reactant_1          INTEGER NOT NULL,
+        reactant_2          INTEGER NOT NULL,
+        product_1           INTEGER NOT NULL,
+        product_2           INTEGER NOT NULL,
+        rate                REAL NOT NULL,
+        dG                  REAL NOT NULL);
+    INSERT INTO metadata VALUES (7, $1);
+    INSERT INTO reactions VALUES (0, 1, 1, 0, -1, 1, -1, 1.0, 0.0);
+    INSERT INTO reactions VALUES (1, 1, 1, 1, -1, 2, -1, 1.0e15, 0.0);
+    INSERT INTO reactions VALUES (2, 1, 1, 3, -1, 4, -1, 1.0e-3, 0.0);
+    INSERT INTO reactions VALUES (3, 1, 1, 5, -1, 6, -1, 1.0, 0.0);"
+
+    if [ "$1" = "5" ]; then
+        sqlite3 ./test_materials/jump_rn.sqlite "
+        INSERT INTO reactions VALUES (4, 1, 1, 1, -1, 2, -1, 1.0e15, 0.0);"
+    fi
+
+    sqlite3 ./test_materials/jump_initial_state.sqlite "
+    CREATE TABLE initial_state (
+        species_id INTEGER NOT NULL PRIMARY KEY,
+        count      INTEGER NOT NULL);
+    CREATE TABLE trajectories (
+        seed        INTEGER NOT NULL,
+        step        INTEGER NOT NULL,
+        reaction_id INTEGER NOT NULL,
+        time        REAL NOT NULL);
+    CREATE TABLE factors (
+        factor_zero      REAL NOT NULL,
+        factor_two       REAL NOT NULL,
+        factor_duplicate REAL NOT NULL);
+    INSERT INTO factors VALUES (1.0, 1.0, 1.0);
+    INSERT INTO initial_state VALUES
+        (0, 1), (1, 0), (2, 0), (3, 1000), (4, 0), (5, 0), (6, 0);"
+}
+
+# number_of_reactions, then extra RNMC options
+check_jump() {
+    jump_network $1
+    shift
+
+    ./RNMC --reaction_database=./test_materials/jump_rn.sqlite --initial_state_database=./test_materials/jump_initial_state.sqlite --number_of_simulations=100 --base_seed=1000 --thread_count=2 --step_cutoff=20 --dependency_threshold=0 --solver=integer_tree "$@" > /dev/null
+
+    sql='SELECT count(*) FROM trajectories a JOIN trajectories b ON a.seed = b.seed AND b.step = a.step + 1 WHERE a.reaction_id = 0 AND b.reaction_id NOT IN (1, 4);'
+    fired_sql='SELECT count(*) FROM trajectories WHERE reaction_id = 0;'
+    unknown_sql='SELECT count(*) FROM trajectories WHERE reaction_id NOT IN (0, 1, 2, 4);'
+
+    if [ "$(sqlite3 ./test_materials/jump_initial_state.sqlite "${sql}")" = "0" ] &&
+       [ "$(sqlite3 ./test_materials/jump_initial_state.sqlite "${fired_sql}")" != "0" ] &&
+       [ "$(sqlite3 ./test_materials/jump_initial_state.sqlite "${unknown_sql}")" = "0" ]; then
+        echo -e "${Green} passed: propensity jump $* ${Color_Off}"
+    else
+        echo -e "${Red} failed: propensity jump $* ${Color_Off}"
+        RC=1
+    fi
+}
+
+check_jump 4
+check_jump 4 --reduce --renumber
+check_jump 5 --reduce --renumber
+
+# the merged reaction is split between reaction 1 and its duplicate
+merged_sql='SELECT count(DISTINCT reaction_id) FROM trajectories WHERE reaction_id IN (1, 4);'
+if [ "$(sqlite3 ./test_materials/jump_initial_state.sqlite "${merged_sql}")" = "2" ]; then
+    echo -e "${Green} passed: merged reactions keep their database ids ${Color_Off}"
+else
+    echo -e "${Red} failed: merged reactions keep their database ids ${Color_Off}"
+    RC=1
+fi
+
+rm ./test_materials/jump_rn.sqlite
+rm ./test_materials/jump_initial_state.sqlite
 exit $RC